@@ -39,19 +39,70 @@
  * I only use C++ STL so no external libraries are needed.
  * I use some C++11 language features though (like the array datatype) so you should use a relatively modern compiler.
  * The Code is kept simple: one class with some helper methods for endianess- or string-translation.
+ * Output formats are free functions on top of CompactPilot::get() and the pilotfields table, every output sink formats and writes
+ * on its own thread, so C++11 threads are needed as well.
+ * Compressed output is optional and needs zlib (gzip) or zstd, enable them with -DTFRDUMP_WITH_ZLIB -lz and
+ * -DTFRDUMP_WITH_ZSTD -lzstd. Writing SQLite databases directly needs -DTFRDUMP_WITH_SQLITE -lsqlite3.
  *
  * Code beautification: \code astyle -A4 tfrdump.cpp \endcode
  *
+ * To use the reading and decoding code in another program, define TFRDUMP_NO_MAIN and include tfrdump.cpp, the lazy
+ * range API in namespace tfr is meant for that. Compiled as C++20, tfr::async_scan() offers the same as coroutine.
+ *
  * \section Compiling
  * Just invoke a C++11 compatible compiler:
- * \code g++ -std=c++0x tfrdump.cpp -O3 -s -o tfrdump \endcode
+ * \code g++ -std=c++0x -pthread tfrdump.cpp -O3 -s -o tfrdump \endcode
  * or
- * \code clang++ -std=c++11 tfrdump.cpp -O3 -s -o tfrdump \endcode
+ * \code clang++ -std=c++11 -pthread tfrdump.cpp -O3 -s -o tfrdump \endcode
  * 
  * \section Usage
  * \code
- * tfrdump <TFR-File>
+ * tfrdump [--out format[:path]]... <TFR-File|directory|archive|->...
+ * tfrdump pack [--layout file]... <TFR-File|directory>... -o archive.tfa
+ * tfrdump summary [--field column]... [--group-by column] [--top N] [--emit-partial file] [--layout file] <inputs>...
+ * tfrdump merge [--emit-partial file] <partials>...
+ * tfrdump coordinator --listen unix:/path|host:port [--chunk N] [summary options] <inputs>...
+ * tfrdump worker --connect unix:/path|host:port [--layout file]
+ * tfrdump patch --journal file --set column=value... [--where column<op>value]... [--layout file]... <inputs>...
+ * tfrdump patch --rollback journal
+ * tfrdump seal|verify --key file --seals file [--layout file]... <inputs>...
+ * tfrdump live --pid N [--like TFR-File|--address addr] [--interval ms] [--layout file]...
+ * tfrdump compare [--color always|never|auto] [--layout file]... <inputs>...
+ * tfrdump --print-layout
+ * \endcode
+ * "-" reads any number of records of PILOTFILESIZE BYTEs from stdin, e.g. <tt>zcat pilots.bin.gz | tfrdump -</tt>.
+ * Directories are searched recursively for *.TFR files. Archives created by \c pack hold any number of pilot files in one
+ * indexed, memory mapped file and can be used wherever pilot files or directories are accepted. Every pilot file is read and decoded exactly once, then handed to
+ * all output sinks. Known formats are \c text (the default), \c json, \c csv, \c sql (CREATE TABLE and batched INSERTs
+ * for PostgreSQL and SQLite) and \c pgcopy (a psql script using COPY); the path defaults to stdout ("-"),
+ * <tt>--format=name</tt> is short for <tt>--out name</tt>. If compiled with SQLite support, \c sqlite:pilots.db creates the
+ * same tables directly in a new database. Example:
+ * \code tfrdump --out text:pilots.txt --out json:pilots.json --out csv:pilots.csv /archive \endcode
+ * The format \c columns writes a directory with one binary file per column and per-block zone maps, which can be
+ * queried repeatedly without reading the pilot files again:
+ * \code
+ * tfrdump --out columns:snapshot /archive
+ * tfrdump query --columns snapshot --where "navyrank>=3" --where "points>100000" --select file,points,kills_5
  * \endcode
+ * <tt>--stats</tt> prints time, cycles, instructions, cache and branch misses of the phases read, decode, format and write
+ * to stderr, <tt>--stats=files</tt> additionally one line per file. Counters need perf_event_open permission. Compiled
+ * with -DTFRDUMP_ALLOC_PROFILE, it also counts the allocations of every phase and fails if reading or decoding
+ * allocated.
+ * <tt>--layout file</tt> (also for \c pack, \c summary and \c worker) decodes pilot files of other game versions, mods
+ * or other games, see Layout::load(). Every file is decoded with the format its size, extension and signature fit best
+ * (Layout::detect()), so one scan handles mixed directories and archives. <tt>--print-layout</tt> prints the layouts
+ * of all formats, the built-in one first, as a starting point.
+ * \c patch changes fields in place, in pilot files and archives, after recording the original BYTEs in a journal
+ * (PatchJournal); <tt>patch --rollback journal</tt> restores them.
+ * \c seal records CRC-32C and a SipHash MAC of every pilot in a seals file, \c verify proves that the pilots were not
+ * changed since (sealPilots()).
+ * \c live follows the pilot in the memory of the running game and prints every change (livePilot()).
+ * \c compare prints several pilots side by side, one column each (PilotComparison).
+ * <tt>--no-cache-pollution</tt> reads pilot files with O_DIRECT and drops archives and stdin from the page cache as they
+ * are consumed, so a nightly scan leaves the cache of other services alone.
+ * With <tt>--compress gzip|zstd[:level]</tt> every output is cut into blocks of 1 MiB which are compressed in parallel on a
+ * thread pool and written in order as independent gzip members or zstd frames; gzip -d and zstd -d read the
+ * concatenation like one file.
  */
 
 #include <iostream>
@@ -59,7 +110,56 @@
 #include <array>
 #include <string>
 #include <vector>
+#include <deque>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <iterator>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <new>
 #include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#ifdef TFRDUMP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TFRDUMP_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef TFRDUMP_WITH_SQLITE
+#include <sqlite3.h>
+#endif
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+#include <coroutine>
+#endif
 using namespace std;
 
 // Define some DOS/hexedit compatible datatypes that are easy to remember.
@@ -67,9 +167,250 @@ typedef uint8_t BYTE;	// 1 Byte: 0 - 255
 typedef uint16_t WORD;	// 2 Bytes: 0 - 65535
 typedef uint32_t DWORD;	// 4 Bytes: 0 - 4294967295
 
-class Pilot {
+const size_t PILOTFILESIZE = 3855;	// filesize is always 3855 BYTEs and all bytes are x00 for new pilots.
+typedef array<BYTE,PILOTFILESIZE> PilotBuffer;
+
+/**
+ * All known fields in file order, used as index into pilotfields and for CompactPilot::get().
+ */
+enum PilotFieldId {
+    F_NAVYRANK, F_DIFFICULTY, F_POINTS, F_LEVEL, F_SECRETRANK,
+    F_TF_CERT, F_TI_CERT, F_TB_CERT, F_TA_CERT, F_GUN_CERT, F_TD_CERT, F_MISSILEBOAT_CERT,
+    F_TF_SIM, F_TI_SIM, F_TB_SIM, F_TA_SIM, F_GUN_SIM, F_TD_SIM, F_MISSILEBOAT_SIM,
+    F_ACTIVEBATTLE, F_BATTLESTATUS, F_MISSIONCHOOSE, F_KILLS,
+    F_LASERSFIRED, F_LASERHITS, F_WARHEADSFIRED, F_WARHEADHITS,
+    F_TRAININGPOINTS, F_BATTLEPOINTS, F_TOTAL, F_CAPTURED, F_LOST,
+    F_COUNT
+};
+
+/**
+ * Description of one known field: name used by the output formats, offset in the file, width of one element in BYTEs
+ * (1 = BYTE, 2 = WORD, 4 = DWORD) and number of elements.
+ */
+struct PilotField {
+    const char* name;
+    WORD offset;
+    BYTE width;
+    BYTE count;
+};
+
+const PilotField pilotfields[F_COUNT] = {
+    {"navyrank", 2, 1, 1},
+    {"difficulty", 3, 1, 1},
+    {"points", 4, 4, 1},
+    {"level", 8, 2, 1},
+    {"secretrank", 10, 1, 1},
+    {"tf_cert", 90, 1, 1},
+    {"ti_cert", 91, 1, 1},
+    {"tb_cert", 92, 1, 1},
+    {"ta_cert", 93, 1, 1},
+    {"gun_cert", 94, 1, 1},
+    {"td_cert", 95, 1, 1},
+    {"missileboat_cert", 96, 1, 1},
+    {"tf_sim", 520, 1, 4},
+    {"ti_sim", 528, 1, 4},
+    {"tb_sim", 536, 1, 4},
+    {"ta_sim", 544, 1, 4},
+    {"gun_sim", 552, 1, 4},
+    {"td_sim", 560, 1, 4},
+    {"missileboat_sim", 568, 1, 4},
+    {"activebattle", 616, 1, 1},
+    {"battlestatus", 617, 1, 13},
+    {"missionchoose", 637, 1, 13},
+    {"kills", 1632, 2, 68},
+    {"lasersfired", 1908, 4, 1},
+    {"laserhits", 1912, 4, 1},
+    {"warheadsfired", 1920, 2, 1},
+    {"warheadhits", 1922, 2, 1},
+    {"trainingpoints", 2064, 4, 28},
+    {"battlepoints", 2914, 4, 104},
+    {"total", 3554, 2, 1},
+    {"captured", 3556, 2, 1},
+    {"lost", 3854, 1, 1}	// last BYTE of the file, a WORD would read past the end
+};
+
+/**
+ * Hot loops are compiled several times for different instruction sets (GCC function multiversioning on x86-64), the
+ * dynamic linker picks the best variant for the CPU at startup, so one binary runs everywhere with its best code.
+ * The loops are written plainly and rely on the auto-vectoriser (-O3).
+ * -DTFRDUMP_NO_MULTIVERSION builds only the default variant. So does -fsanitize=thread, because the ifunc resolvers
+ * run before the ThreadSanitizer runtime is set up and crash the program at startup.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__) \
+        && !defined(TFRDUMP_NO_MULTIVERSION) && !defined(__SANITIZE_THREAD__)
+#define TFRDUMP_CLONES
+#define TFRDUMP_MULTIVERSION __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#define TFRDUMP_KERNEL inline __attribute__((always_inline))	// helpers of multiversioned functions
+#else
+#define TFRDUMP_MULTIVERSION
+#define TFRDUMP_KERNEL inline
+#endif
+
+/**
+ * Name of the kernel variant this CPU runs, for --stats.
+ */
+const char* kernelTarget()
+{
+#ifdef TFRDUMP_CLONES
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("x86-64-v4"))
+        return "x86-64-v4 (AVX-512)";
+    if(__builtin_cpu_supports("x86-64-v3"))
+        return "x86-64-v3 (AVX2)";
+#endif
+    return "default";
+}
+
+/**
+ * Decode n consecutive WORDs starting at src, see Pilot::betoW().
+ */
+TFRDUMP_MULTIVERSION
+void decodeWords(const BYTE* src, WORD* dst, size_t n)
+{
+    for(size_t i=0; i<n; ++i)
+        dst[i] = src[2*i] | src[2*i+1] << 8;
+}
+
+/**
+ * Decode n consecutive DWORDs starting at src, see Pilot::betoDW().
+ */
+TFRDUMP_MULTIVERSION
+void decodeDWords(const BYTE* src, DWORD* dst, size_t n)
+{
+    for(size_t i=0; i<n; ++i)
+        dst[i] = src[4*i] | src[4*i+1] << 8 | src[4*i+2] << 16 | (DWORD) src[4*i+3] << 24;
+}
+
+/**
+ * dst[i] |= src[i] for n WORDs: which kill counters are not zero in any of several pilots, see PilotComparison.
+ */
+TFRDUMP_MULTIVERSION
+void orWords(const WORD* src, WORD* dst, size_t n)
+{
+    for(size_t i=0; i<n; ++i)
+        dst[i] |= src[i];
+}
+
+/**
+ * memcpy() for the short runs of a decode plan: two overlapping fixed size copies instead of a library call.
+ */
+inline void copyBytes(BYTE* dst, const BYTE* src, size_t n)
+{
+    if(n > 16)
+        memcpy(dst, src, n);
+    else if(n >= 8) {
+        memcpy(dst, src, 8);
+        memcpy(dst + n - 8, src + n - 8, 8);
+    } else if(n >= 4) {
+        memcpy(dst, src, 4);
+        memcpy(dst + n - 4, src + n - 4, 4);
+    } else if(n >= 2) {
+        memcpy(dst, src, 2);
+        memcpy(dst + n - 2, src + n - 2, 2);
+    } else if(n)
+        *dst = *src;
+}
+
+/**
+ * Minimum and maximum of n > 0 values.
+ */
+TFRDUMP_MULTIVERSION
+void minMax(const DWORD* values, size_t n, DWORD& min, DWORD& max)
+{
+    DWORD lo = values[0], hi = values[0];
+    for(size_t i=1; i<n; ++i) {
+        lo = values[i] < lo ? values[i] : lo;
+        hi = values[i] > hi ? values[i] : hi;
+    }
+    min = lo;
+    max = hi;
+}
+
+/**
+ * Operations of a decode plan.
+ */
+enum DecodeOp {
+    DECODE_BYTES,	// copy count BYTEs
+    DECODE_WORD,	// one WORD, see Pilot::betoW()
+    DECODE_DWORD,	// one DWORD, see Pilot::betoDW()
+    DECODE_WORDS,	// count WORDs, see decodeWords()
+    DECODE_DWORDS,	// count DWORDs, see decodeDWords()
+    DECODE_WIDEN,	// count values of width BYTEs into members of target BYTEs, e.g. the BYTE lost into a WORD
+    DECODE_ZERO		// clear count BYTEs of members the layout does not have
+};
+
+/**
+ * One step of a decode plan: read from offset in the record and write to the Pilot member at member.
+ */
+struct DecodeStep {
+    BYTE op;
+    BYTE width;
+    BYTE target;
+    WORD offset;
+    WORD count;
+    WORD member;
+};
+
+/**
+ * A pilot file format: how its files are recognised (size, extension, signature), where the fields are and the names
+ * of enumerated values. The built-in format is TIE Fighter of the German CD edition (pilotfields), others (modded or
+ * regional versions, pilot files of other games) are loaded from text files at startup (see load()) and registered
+ * in formats(). detect() picks the format of every record from what was read anyway, so mixed inputs need no second
+ * read.
+ * A layout is compiled into a flat list of DecodeSteps which Pilot runs for every record, the built-in layout too,
+ * so a loaded layout decodes exactly as fast.
+ *
+ * The schema stays the same for every layout: a layout may move fields, store them narrower or leave array elements
+ * or whole fields out (they decode as 0), but every format is written with the columns and types of pilotfields.
+ */
+class Layout {
+public:
+    string name;
+    size_t size;	// BYTEs of a pilot file, at most PILOTFILESIZE
+    string extension;	// lower case, e.g. ".tfr"
+    WORD signatureoffset;
+    string signature;	// BYTEs at signatureoffset, empty if the format has none
+    PilotField fields[F_COUNT];
+    vector<string> enums[F_COUNT];	// names of the values 0, 1, ... of enumerated fields
+    vector<DecodeStep> plan;
+
+    Layout() : size(PILOTFILESIZE), signatureoffset(0) {}
+
+    static const Layout& builtin();
+
+    /**
+     * All known formats, builtin() first. Only changed at startup (--layout).
+     */
+    static vector<const Layout*>& formats()
+    {
+        static vector<const Layout*> known(1, &builtin());
+        return known;
+    }
+
+    static const Layout& detect(const string& name, const BYTE* record, size_t size);
+    static bool isKnownExtension(const string& name);
+
+    bool load(const string&);
+    void print(ostream&) const;
+    int match(const string& name, const BYTE* record, size_t size) const;
+    bool hasExtension(const string& name) const;
+
+    const char* enumName(PilotFieldId field, DWORD value) const
+    {
+        return value < enums[field].size() ? enums[field][value].c_str() : "unknown";
+    }
+
+private:
+    void compile();
+};
+
+/**
+ * The decoded fields of a pilot file without the file itself, about 800 BYTEs in natural alignment instead of the
+ * 4.7 KiB of a Pilot. Everything that only needs the values (outputs, summaries, pilots kept in memory) uses it.
+ */
+class CompactPilot {
 private:
-    array<BYTE,3855> pilotfilebuffer; // filesize is always 3855 BYTEs and all bytes are x00 for new pilots. Use this array to buffer the file.
+    const Layout* layout;	// where the fields were decoded from and names of enumerated values
 
     BYTE unused1;		// 00, (always 00? why? purpose?)
     BYTE unused2;		// 01, (always 00? why? purpose?)
@@ -96,13 +437,13 @@ private:
     /**********************************
     Medals for Fightsimulation. Every ship has 4 missions, default value: 00, completed: 01. With 2 completed you gain bronze, then silver, then gold medals.
     **********************************/
-    BYTE tf_sim[3];		// 520-523
-    BYTE ti_sim[3];		// 528-531
-    BYTE tb_sim[3];		// 536-539
-    BYTE ta_sim[3];		// 544-547
-    BYTE gun_sim[3];		// 552-555
-    BYTE td_sim[3];		// 560-563
-    BYTE missileboat_sim[3];	// 568-571
+    BYTE tf_sim[4];		// 520-523
+    BYTE ti_sim[4];		// 528-531
+    BYTE tb_sim[4];		// 536-539
+    BYTE ta_sim[4];		// 544-547
+    BYTE gun_sim[4];		// 552-555
+    BYTE td_sim[4];		// 560-563
+    BYTE missileboat_sim[4];	// 568-571
 
     /**********************************
      * Active Battle and Missionstatus
@@ -116,7 +457,7 @@ private:
     Kills. This is no map container because I need the structure ordered according to the TFR file.
     **********************************/
     array<WORD,68> kills;
-    const array<string,68> shipnames = {
+    static constexpr array<const char*,68> shipnames = {
         "X-W", //#0 Rebel fighters	@1632
         "Y-W",
         "A-W",
@@ -212,50 +553,60 @@ private:
     **********************************/
     WORD total;		//3555 3554
     WORD captured;	//3556 BYTE sure, WORD guess
-    WORD lost;		//3854
+    WORD lost;		//3854, last BYTE of the file
 
     /*********************/
 
 public:
-    Pilot(char*);
-    friend ostream& operator<<(ostream&, Pilot);
-    WORD betoW(unsigned short);
-    DWORD betoDW(unsigned short);
+    CompactPilot(const BYTE*, const Layout& = Layout::builtin());
+    static void member(PilotFieldId, size_t& offset, BYTE& width, BYTE& count);
+    friend ostream& operator<<(ostream&, const CompactPilot&);
+    friend class PilotComparison;
+    DWORD get(PilotFieldId, int index = 0) const;
+
+    const char* navyrank_toString() const;
+    const char* difficulty_toString() const;
+    const char* secretrank_toString() const;
+    const char* getmedal(BYTE) const;
+};
+
+constexpr array<const char*,68> CompactPilot::shipnames;
+
+/**
+ * A decoded pilot together with a copy of its file, e.g. to look at BYTEs nobody has decoded yet.
+ */
+class Pilot : public CompactPilot {
+private:
+    PilotBuffer pilotfilebuffer; // Use this array to buffer the file.
 
-    string navyrank_toString();
-    string difficulty_toString();
-    string secretrank_toString();
-    string getmedal(BYTE);
+public:
+    Pilot(const BYTE*, const Layout& = Layout::builtin());
+    WORD betoW(unsigned short) const;
+    DWORD betoDW(unsigned short) const;
 };
 
 /**
  * Translate the current rank number into a string
  */
-string Pilot::navyrank_toString()
+const char* CompactPilot::navyrank_toString() const
 {
-    const string ranks[] = {"Cadet", "Officer", "Lieutenant", "Captain", "Commander", "General"};
-    return ranks[navyrank];
+    return layout->enumName(F_NAVYRANK, navyrank);
 }
 
 /**
  * Translate the game difficulty into a string
  */
-string Pilot::difficulty_toString()
+const char* CompactPilot::difficulty_toString() const
 {
-    const string diffs[] = {"easy", "medium", "hard"};
-    return diffs[difficulty];
+    return layout->enumName(F_DIFFICULTY, difficulty);
 }
 
 /**
  * Translate the current rank of the secret order number into a string
  */
-string Pilot::secretrank_toString()
+const char* CompactPilot::secretrank_toString() const
 {
-    const string ranks[] = {"None", "First Initiate", "Second Circle", "Third Circle", "Fourth Circle",
-                            "Inner Circle", "Emperor's Hand", "Emperor's Eyes", "Emperor's Voice",
-                            "Emperor's Reach"
-                           };
-    return ranks[secretrank];
+    return layout->enumName(F_SECRETRANK, secretrank);
 }
 
 /**
@@ -267,7 +618,7 @@ string Pilot::secretrank_toString()
  * This is not needed on big endian systems like DOS/Windows; if you use such systems, just append the offset and it's 
  * successor to x without any shifting, patches welcome.
  */
-WORD Pilot::betoW(unsigned short offset)
+WORD Pilot::betoW(unsigned short offset) const
 {
     WORD x = 0;
     x |= (BYTE) pilotfilebuffer[offset+1] << 8;
@@ -284,7 +635,7 @@ WORD Pilot::betoW(unsigned short offset)
  * This is not needed on big endian systems like DOS/Windows; if you use such systems, just append the offset and it's three
  * successors to x without any shifting, patches welcome.
  */
-DWORD Pilot::betoDW(unsigned short offset)
+DWORD Pilot::betoDW(unsigned short offset) const
 {
     DWORD x = 0;
     x |= (BYTE) pilotfilebuffer[offset+3] << 24;
@@ -294,7 +645,7 @@ DWORD Pilot::betoDW(unsigned short offset)
     return x;
 }
 
-string Pilot::getmedal(BYTE ship)
+const char* CompactPilot::getmedal(BYTE ship) const
 {
     switch(ship) {
     case 2:
@@ -308,81 +659,501 @@ string Pilot::getmedal(BYTE ship)
     }
 }
 
-Pilot::Pilot(char* filename)
+/**
+ * Decode a complete pilot file of PILOTFILESIZE BYTEs (see readPilotFile()) by running the decode plan of layout (see
+ * Layout::compile()).
+ */
+CompactPilot::CompactPilot(const BYTE* buffer, const Layout& layout)
+    : layout(&layout), unused1(0), unused2(0), unused_cert()	// not in the schema, no layout says where they are
 {
-    // create a zero-filled filebuffer, then read the file into it
-    pilotfilebuffer.fill(0x0);
-    char *readbuffer = new char;
-    ifstream pilotstream(filename, ios::in|ios::binary);
-    if(pilotstream.is_open()) {
-        for(int i=0; i < 3855 ; ++i) {
-            pilotstream.read(readbuffer,1);
-            pilotfilebuffer[i] = (BYTE) *readbuffer;
+    BYTE* members = reinterpret_cast<BYTE*>(this);
+    for(const DecodeStep& step : layout.plan) {
+        const BYTE* src = buffer + step.offset;
+        BYTE* dst = members + step.member;
+        switch(step.op) {
+        case DECODE_BYTES:
+            copyBytes(dst, src, step.count);
+            break;
+        case DECODE_WORD:
+            *reinterpret_cast<WORD*>(dst) = src[0] | src[1] << 8;
+            break;
+        case DECODE_DWORD:
+            *reinterpret_cast<DWORD*>(dst) = src[0] | src[1] << 8 | src[2] << 16 | (DWORD) src[3] << 24;
+            break;
+        case DECODE_WORDS:
+            decodeWords(src, reinterpret_cast<WORD*>(dst), step.count);
+            break;
+        case DECODE_DWORDS:
+            decodeDWords(src, reinterpret_cast<DWORD*>(dst), step.count);
+            break;
+        case DECODE_WIDEN:
+            for(int i=0; i<step.count; ++i) {
+                DWORD x = 0;
+                for(int b=0; b<step.width; ++b)
+                    x |= (DWORD) src[i * step.width + b] << 8 * b;
+                if(step.target == 2)
+                    reinterpret_cast<WORD*>(dst)[i] = x;
+                else
+                    reinterpret_cast<DWORD*>(dst)[i] = x;
+            }
+            break;
+        default:
+            memset(dst, 0, step.count);
         }
     }
-    pilotstream.close();
-    delete readbuffer;
-    
-    // assign values from the buffer to member variables, convert WORD and DWORD values to lower endian.
-    navyrank = pilotfilebuffer[2];
-    difficulty = pilotfilebuffer[3];	// 03, (value 00 easy, 01 medium, 02 hard)
-    points = betoDW(4);			// 07 06 05 04, (value 00 00 00 00 - ff ff ff ff max works in registry, but overflows ingame; xx xx xx 79 works)
-    level = betoW(8);			// 09 08, (value 00 00 - ff ff)
-    secretrank = pilotfilebuffer[10];
-
-    tf_cert = pilotfilebuffer[90];
-    ti_cert = pilotfilebuffer[91];
-    tb_cert = pilotfilebuffer[92];
-    ta_cert = pilotfilebuffer[93];
-    gun_cert = pilotfilebuffer[94];
-    td_cert = pilotfilebuffer[95];
-    missileboat_cert = pilotfilebuffer[96];
-    for(int i=0; i<5; ++i)
-        unused_cert[i] = pilotfilebuffer[97+i];	// 97 - 101	(value: 02)
-
-    //Medals for Fightsimulation. There is a DWORD unused space after each ship:
-    //Maybe all Battles (even trainings) have place for 8 missions; here we use only 4.
-    for(int i=0; i<4; ++i) {
-        tf_sim[i] = pilotfilebuffer[520+i];	// 520-523
-        ti_sim[i] = pilotfilebuffer[528+i];	// 528-531
-        tb_sim[i] = pilotfilebuffer[536+i];	// 536-539
-        ta_sim[i] = pilotfilebuffer[544+i];	// 544-547
-        gun_sim[i] = pilotfilebuffer[552+i];	// 552-555
-        td_sim[i] = pilotfilebuffer[560+i];	// 560-563
-        missileboat_sim[i] = pilotfilebuffer[568+i];// 568-571
+}
+
+/**
+ * Decode a complete pilot file of PILOTFILESIZE BYTEs and keep a copy of it.
+ */
+Pilot::Pilot(const BYTE* buffer, const Layout& layout) : CompactPilot(buffer, layout)
+{
+    copy(buffer, buffer + PILOTFILESIZE, pilotfilebuffer.begin());
+}
+
+/**
+ * Generic read access to the decoded member variables, index selects the element of array fields.
+ * This is what the machine readable output formats use, so they don't need to know every member.
+ */
+DWORD CompactPilot::get(PilotFieldId field, int index) const
+{
+    switch(field) {
+    case F_NAVYRANK:
+        return navyrank;
+    case F_DIFFICULTY:
+        return difficulty;
+    case F_POINTS:
+        return points;
+    case F_LEVEL:
+        return level;
+    case F_SECRETRANK:
+        return secretrank;
+    case F_TF_CERT:
+        return tf_cert;
+    case F_TI_CERT:
+        return ti_cert;
+    case F_TB_CERT:
+        return tb_cert;
+    case F_TA_CERT:
+        return ta_cert;
+    case F_GUN_CERT:
+        return gun_cert;
+    case F_TD_CERT:
+        return td_cert;
+    case F_MISSILEBOAT_CERT:
+        return missileboat_cert;
+    case F_TF_SIM:
+        return tf_sim[index];
+    case F_TI_SIM:
+        return ti_sim[index];
+    case F_TB_SIM:
+        return tb_sim[index];
+    case F_TA_SIM:
+        return ta_sim[index];
+    case F_GUN_SIM:
+        return gun_sim[index];
+    case F_TD_SIM:
+        return td_sim[index];
+    case F_MISSILEBOAT_SIM:
+        return missileboat_sim[index];
+    case F_ACTIVEBATTLE:
+        return activebattle;
+    case F_BATTLESTATUS:
+        return battlestatus[index];
+    case F_MISSIONCHOOSE:
+        return missionchoose[index];
+    case F_KILLS:
+        return kills[index];
+    case F_LASERSFIRED:
+        return lasersfired;
+    case F_LASERHITS:
+        return laserhits;
+    case F_WARHEADSFIRED:
+        return warheadsfired;
+    case F_WARHEADHITS:
+        return warheadhits;
+    case F_TRAININGPOINTS:
+        return trainingpoints[index];
+    case F_BATTLEPOINTS:
+        return battlepoints[index];
+    case F_TOTAL:
+        return total;
+    case F_CAPTURED:
+        return captured;
+    case F_LOST:
+        return lost;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * BYTEs per element and number of elements of a member, see CompactPilot::member().
+ */
+template<typename T>
+struct MemberType {
+    static const BYTE width = sizeof(T);
+    static const BYTE count = 1;
+};
+
+template<typename T, size_t N>
+struct MemberType<T[N]> {
+    static const BYTE width = sizeof(T);
+    static const BYTE count = N;
+};
+
+template<typename T, size_t N>
+struct MemberType<array<T,N> > {
+    static const BYTE width = sizeof(T);
+    static const BYTE count = N;
+};
+
+/**
+ * Where the decoded values of field are stored: offset in CompactPilot, BYTEs per element and number of elements.
+ */
+void CompactPilot::member(PilotFieldId field, size_t& offset, BYTE& width, BYTE& capacity)
+{
+#define TFRDUMP_MEMBER(id, m) case id: \
+        offset = offsetof(CompactPilot, m); \
+        width = MemberType<decltype(m)>::width; \
+        capacity = MemberType<decltype(m)>::count; \
+        break;
+    switch(field) {
+        TFRDUMP_MEMBER(F_NAVYRANK, navyrank)
+        TFRDUMP_MEMBER(F_DIFFICULTY, difficulty)
+        TFRDUMP_MEMBER(F_POINTS, points)
+        TFRDUMP_MEMBER(F_LEVEL, level)
+        TFRDUMP_MEMBER(F_SECRETRANK, secretrank)
+        TFRDUMP_MEMBER(F_TF_CERT, tf_cert)
+        TFRDUMP_MEMBER(F_TI_CERT, ti_cert)
+        TFRDUMP_MEMBER(F_TB_CERT, tb_cert)
+        TFRDUMP_MEMBER(F_TA_CERT, ta_cert)
+        TFRDUMP_MEMBER(F_GUN_CERT, gun_cert)
+        TFRDUMP_MEMBER(F_TD_CERT, td_cert)
+        TFRDUMP_MEMBER(F_MISSILEBOAT_CERT, missileboat_cert)
+        TFRDUMP_MEMBER(F_TF_SIM, tf_sim)
+        TFRDUMP_MEMBER(F_TI_SIM, ti_sim)
+        TFRDUMP_MEMBER(F_TB_SIM, tb_sim)
+        TFRDUMP_MEMBER(F_TA_SIM, ta_sim)
+        TFRDUMP_MEMBER(F_GUN_SIM, gun_sim)
+        TFRDUMP_MEMBER(F_TD_SIM, td_sim)
+        TFRDUMP_MEMBER(F_MISSILEBOAT_SIM, missileboat_sim)
+        TFRDUMP_MEMBER(F_ACTIVEBATTLE, activebattle)
+        TFRDUMP_MEMBER(F_BATTLESTATUS, battlestatus)
+        TFRDUMP_MEMBER(F_MISSIONCHOOSE, missionchoose)
+        TFRDUMP_MEMBER(F_KILLS, kills)
+        TFRDUMP_MEMBER(F_LASERSFIRED, lasersfired)
+        TFRDUMP_MEMBER(F_LASERHITS, laserhits)
+        TFRDUMP_MEMBER(F_WARHEADSFIRED, warheadsfired)
+        TFRDUMP_MEMBER(F_WARHEADHITS, warheadhits)
+        TFRDUMP_MEMBER(F_TRAININGPOINTS, trainingpoints)
+        TFRDUMP_MEMBER(F_BATTLEPOINTS, battlepoints)
+        TFRDUMP_MEMBER(F_TOTAL, total)
+        TFRDUMP_MEMBER(F_CAPTURED, captured)
+        TFRDUMP_MEMBER(F_LOST, lost)
+    default:
+        offset = width = capacity = 0;
     }
+#undef TFRDUMP_MEMBER
+}
 
-    activebattle = pilotfilebuffer[616];	// 616		(value: 00-xx? aka the last completed battle)
+/**
+ * The layout of the German CD-ROM edition, see pilotfields.
+ */
+const Layout& Layout::builtin()
+{
+    static const Layout layout = []() {
+        static const char* const ranks[] = {"Cadet", "Officer", "Lieutenant", "Captain", "Commander", "General"};
+        static const char* const diffs[] = {"easy", "medium", "hard"};
+        static const char* const secretranks[] = {"None", "First Initiate", "Second Circle", "Third Circle",
+                                                  "Fourth Circle", "Inner Circle", "Emperor's Hand", "Emperor's Eyes",
+                                                  "Emperor's Voice", "Emperor's Reach"
+                                                 };
+        Layout german;
+        german.name = "TIE Fighter CD-ROM (german)";
+        german.extension = ".tfr";
+        copy(pilotfields, pilotfields + F_COUNT, german.fields);
+        german.enums[F_NAVYRANK].assign(ranks, ranks + 6);
+        german.enums[F_DIFFICULTY].assign(diffs, diffs + 3);
+        german.enums[F_SECRETRANK].assign(secretranks, secretranks + 10);
+        german.compile();
+        return german;
+    }();
+    return layout;
+}
+
+/**
+ * Build the decode plan: one step per field in file order, fields which are neighbours in the file and in Pilot (like
+ * the certificates) are merged into one step. On little endian hosts the records already have the byte order of the
+ * members, so WORDs and DWORDs are copied like BYTEs.
+ */
+void Layout::compile()
+{
+    plan.clear();
+    for(int f=0; f<F_COUNT; ++f) {
+        size_t member;
+        BYTE target, capacity;
+        CompactPilot::member(PilotFieldId(f), member, target, capacity);
+        DecodeStep step = {DECODE_WIDEN, fields[f].width, target, fields[f].offset, fields[f].count, WORD(member)};
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if(step.width == step.target) {
+            step.count *= step.width;
+            step.width = step.target = 1;
+        }
+#endif
+        DecodeStep* last = plan.empty() ? 0 : &plan.back();
+        if(step.count && last && last->op != DECODE_ZERO && last->width == step.width && last->target == step.target
+                && last->offset + last->count * step.width == step.offset
+                && last->member + last->count * step.target == step.member)
+            last->count += step.count;
+        else if(step.count)
+            plan.push_back(step);
+        if(fields[f].count < capacity) {
+            DecodeStep zero = {DECODE_ZERO, 0, 0, 0, WORD((capacity - fields[f].count) * target),
+                               WORD(member + fields[f].count * target)
+                              };
+            plan.push_back(zero);
+        }
+    }
+    for(size_t s=0; s<plan.size(); ++s) {
+        DecodeStep& step = plan[s];
+        if(step.op == DECODE_ZERO || step.width != step.target)
+            continue;
+        if(step.width == 1)
+            step.op = DECODE_BYTES;
+        else if(step.width == 2)
+            step.op = step.count == 1 ? DECODE_WORD : DECODE_WORDS;
+        else
+            step.op = step.count == 1 ? DECODE_DWORD : DECODE_DWORDS;
+    }
+}
 
-    for(int i=0; i<battlestatus.size(); i++)
-        battlestatus[i] = pilotfilebuffer[617+i];	// 617-623	(value: active: 01, killed/captured: 02, complete: 03, killed/captured: 04)
+/**
+ * Read a layout file. It starts from the built-in layout and changes what it lists, one statement per line:
+ * \code
+ * # TIE Fighter floppy edition
+ * name TIE Fighter floppy
+ * size 3855
+ * extension .tfr
+ * signature 0 00 00
+ * field points 4 4 1
+ * field captured 3556 1 1
+ * field missionchoose none
+ * enum secretrank 6 Emperor's Hand
+ * \endcode
+ * \c size, \c extension and \c signature (offset and hex BYTEs) identify the files of the format, see match().
+ * \c field takes the column name, offset, width in BYTEs and number of elements, or \c none for fields the format
+ * does not have (they decode as 0); <tt>field * none</tt> clears all fields, e.g. for the files of another game.
+ * Fields must fit into the size and into the schema (at most the width and count of pilotfields). \c enum names one
+ * value of a field, the first \c enum line of a field replaces all its built-in names. Errors are reported with file
+ * and line.
+ */
+bool Layout::load(const string& path)
+{
+    *this = builtin();
+    ifstream in(path.c_str());
+    if(!in.is_open()) {
+        cerr << "Cannot open layout " << path << endl;
+        return false;
+    }
+    bool renamed[F_COUNT] = {false};
+    string line;
+    for(int number=1; getline(in, line); ++number) {
+        istringstream words(line);
+        string keyword, field;
+        if(!(words >> keyword) || keyword[0] == '#')
+            continue;
+        int f = 0;
+        bool ok = true;
+        if(keyword == "name") {
+            getline(words >> ws, name);
+        } else if(keyword == "size") {
+            ok = (words >> size) && size > 0 && size <= PILOTFILESIZE;
+        } else if(keyword == "extension") {
+            ok = (words >> extension) && extension[0] == '.';
+            transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        } else if(keyword == "signature") {
+            unsigned offset, value;
+            ok = bool(words >> offset);
+            signature.clear();
+            while(ok && words >> hex >> value) {
+                ok = value < 256;
+                signature += char(value);
+            }
+            signatureoffset = offset;
+            ok = ok && words.eof() && !signature.empty() && offset + signature.size() <= PILOTFILESIZE;
+        } else if(keyword == "field" || keyword == "enum") {
+            ok = bool(words >> field);
+            while(f < F_COUNT && field != pilotfields[f].name)
+                ++f;
+            ok = ok && (f < F_COUNT || (keyword == "field" && field == "*"));
+        } else
+            ok = false;
+        if(ok && keyword == "field" && f == F_COUNT) {	// field * none
+            string none;
+            ok = (words >> none) && none == "none";
+            for(int i=0; ok && i<F_COUNT; ++i)
+                fields[i].count = 0;
+        } else if(ok && keyword == "field") {
+            string offset;
+            unsigned width = 0, count = 0;
+            ok = bool(words >> offset);
+            if(ok && offset == "none") {
+                fields[f].count = 0;
+            } else if(ok) {
+                char* end;
+                unsigned long at = strtoul(offset.c_str(), &end, 0);
+                BYTE target, capacity;
+                size_t member;
+                CompactPilot::member(PilotFieldId(f), member, target, capacity);
+                ok = *end == 0 && (words >> width >> count) && (width == 1 || width == 2 || width == 4)
+                     && width <= target && width <= pilotfields[f].width && count <= pilotfields[f].count
+                     && at + width * count <= PILOTFILESIZE;
+                fields[f].offset = at;
+                fields[f].width = width;
+                fields[f].count = count;
+            }
+        } else if(ok && keyword == "enum") {
+            size_t value;
+            string text;
+            ok = (words >> value) && getline(words >> ws, text) && value < 256;
+            if(ok && !renamed[f]) {
+                enums[f].clear();
+                renamed[f] = true;
+            }
+            if(ok && enums[f].size() <= value)
+                enums[f].resize(value + 1, "unknown");
+            if(ok)
+                enums[f][value] = text;
+        }
+        if(!ok) {
+            cerr << path << ":" << number << ": cannot use \"" << line << "\"" << endl;
+            return false;
+        }
+    }
+    for(int f=0; f<F_COUNT; ++f) {
+        if(fields[f].count && (size_t) (fields[f].offset + fields[f].width * fields[f].count) > size) {
+            cerr << path << ": field " << pilotfields[f].name << " does not fit into files of " << size << " BYTEs"
+                 << endl;
+            return false;
+        }
+    }
+    compile();
+    return true;
+}
 
-    for(int i=0; i<missionchoose.size(); i++)
-        missionchoose[i] = pilotfilebuffer[637+i];// 637-643	(value: 00-06, stays at the max mission # for the battle)
+/**
+ * Write the layout in the syntax of load(), e.g. as a starting point for another version.
+ */
+void Layout::print(ostream& out) const
+{
+    out << "name " << name << endl
+        << "size " << size << endl
+        << "extension " << extension << endl;
+    if(!signature.empty()) {
+        const char hex[] = "0123456789abcdef";
+        out << "signature " << signatureoffset;
+        for(size_t i=0; i<signature.size(); ++i)
+            out << " " << hex[(BYTE) signature[i] >> 4] << hex[signature[i] & 0xf];
+        out << endl;
+    }
+    for(int f=0; f<F_COUNT; ++f) {
+        if(fields[f].count == 0)
+            out << "field " << pilotfields[f].name << " none" << endl;
+        else
+            out << "field " << pilotfields[f].name << " " << fields[f].offset << " " << (int) fields[f].width << " "
+                << (int) fields[f].count << endl;
+    }
+    for(int f=0; f<F_COUNT; ++f)
+        for(size_t v=0; v<enums[f].size(); ++v)
+            out << "enum " << pilotfields[f].name << " " << v << " " << enums[f][v] << endl;
+}
 
-    for(int i=0; i<kills.size(); i++)
-        kills[i] = betoW(1632+i*sizeof(WORD));
+/**
+ * How well a pilot file fits this format, -1 if it cannot be one: 4 for a matching signature, 2 for the size (0 if
+ * not known, e.g. in older archives) and 1 for the extension of name.
+ */
+int Layout::match(const string& name, const BYTE* record, size_t size) const
+{
+    int score = 0;
+    if(!signature.empty()) {
+        if(memcmp(record + signatureoffset, signature.data(), signature.size()) != 0)
+            return -1;
+        score += 4;
+    }
+    if(size && size == this->size)
+        score += 2;
+    if(hasExtension(name))
+        score += 1;
+    return score;
+}
 
-    lasersfired = betoDW(1908); //Lasers fired:	1911? 1910? 1909 1908
-    laserhits = betoDW(1912); //Laser hits:		1915? 1914? 1913 1912
-    warheadsfired = betoW(1920); //Fired warheads:	1921 1920
-    warheadhits = betoW(1922); //Warhead hits:		1923 1922
+/**
+ * Check name for the extension of the format, case insensitive.
+ */
+bool Layout::hasExtension(const string& name) const
+{
+    if(extension.empty() || name.size() < extension.size())
+        return false;
+    for(size_t i=0, at=name.size()-extension.size(); i<extension.size(); ++i)
+        if(tolower((unsigned char) name[at + i]) != extension[i])
+            return false;
+    return true;
+}
 
-    for(int i=0; i<trainingpoints.size(); i++)
-        trainingpoints[i] = betoDW(2064+i*sizeof(DWORD));
+/**
+ * The format of a pilot file from its name, the BYTEs read and its size: the best match(), of equally good ones the
+ * one registered last, so a --layout file without size, extension and signature replaces the built-in layout.
+ * Files no format fits are decoded with the built-in layout.
+ */
+const Layout& Layout::detect(const string& name, const BYTE* record, size_t size)
+{
+    const vector<const Layout*>& known = formats();
+    if(known.size() == 1)
+        return *known[0];
+    const Layout* best = known[0];
+    int bestscore = -1;
+    for(size_t i=known.size(); i-- > 0; ) {
+        int score = known[i]->match(name, record, size);
+        if(score > bestscore) {
+            best = known[i];
+            bestscore = score;
+        }
+    }
+    return *best;
+}
 
-    for(int i=0; i<battlepoints.size(); i++)
-        battlepoints[i] = betoDW(2914+i*sizeof(DWORD));
+/**
+ * Check name for the extension of a known format, case insensitive.
+ */
+bool Layout::isKnownExtension(const string& name)
+{
+    const vector<const Layout*>& known = formats();
+    for(size_t i=0; i<known.size(); ++i)
+        if(known[i]->hasExtension(name))
+            return true;
+    return false;
+}
 
-    total = betoW(3554);
-    captured = betoW(3556);	//3556 BYTE sure, WORD guessed
-    lost = betoW(3854);
+/**
+ * Load a layout file and register it as a format of the pilots read from now on (--layout).
+ */
+bool addLayoutFile(const string& path)
+{
+    static deque<Layout> layouts;	// never moved, Pilots point to them
+    layouts.push_back(Layout());
+    if(!layouts.back().load(path)) {
+        layouts.pop_back();
+        return false;
+    }
+    Layout::formats().push_back(&layouts.back());
+    return true;
 }
 
 /**
  * Print everything to stdout. Could be adapted to xml or whatever if you plan to write a remake :-)
  */
-ostream& operator<<(ostream& out, Pilot p)
+ostream& operator<<(ostream& out, const CompactPilot& p)
 {
     out
             << "Navyrank:\t" << p.navyrank_toString() // { CADET, OFFICER, LIEUTENANT, CAPTAIN, COMMANDER, GENERAL };	// 02, (value 00 - 05)
@@ -501,12 +1272,5836 @@ ostream& operator<<(ostream& out, Pilot p)
     return out;
 }
 
-int main(int argc, char* argv[])
+/**
+ * Print a string quoted for JSON output.
+ */
+void jsonQuote(ostream& out, const string& s)
 {
-    if(argc != 2) {
-        cerr << "Please name a pilot file as parameter" << endl;
-        return -1;
+    out << '"';
+    for(size_t i=0; i<s.size(); ++i) {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if(c < 0x20) {
+            const char hex[] = "0123456789abcdef";
+            out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+/**
+ * Print a string for CSV output, quoted only if needed (RFC 4180).
+ */
+void csvQuote(ostream& out, const char* s, size_t size)
+{
+    size_t special = 0;
+    while(special < size && s[special] != ',' && s[special] != '"' && s[special] != '\r' && s[special] != '\n')
+        ++special;
+    if(special == size) {
+        out.write(s, size);
+        return;
+    }
+    out << '"';
+    for(size_t i=0; i<size; ++i) {
+        if(s[i] == '"')
+            out << '"';
+        out << s[i];
+    }
+    out << '"';
+}
+
+/**
+ * Print one pilot as JSON object, array fields become JSON arrays.
+ */
+void writeJSON(ostream& out, const CompactPilot& p, const string& name)
+{
+    out << "{\"file\": ";
+    jsonQuote(out, name);
+    for(int f=0; f<F_COUNT; ++f) {
+        const PilotField& field = pilotfields[f];
+        out << ", \"" << field.name << "\": ";
+        if(field.count == 1) {
+            out << p.get(PilotFieldId(f));
+            continue;
+        }
+        out << "[";
+        for(int i=0; i<field.count; ++i)
+            out << (i ? ", " : "") << p.get(PilotFieldId(f), i);
+        out << "]";
+    }
+    out << "}";
+}
+
+/**
+ * Name of one column in the CSV and column exports: the field name, array fields get the element index appended
+ * (kills_0, kills_1, ...).
+ */
+string columnName(int field, int index)
+{
+    if(pilotfields[field].count == 1)
+        return pilotfields[field].name;
+    ostringstream name;
+    name << pilotfields[field].name << "_" << index;
+    return name.str();
+}
+
+/**
+ * Print the CSV header line matching writeCSV(), array fields get one column per element: kills_0, kills_1, ...
+ */
+void writeCSVHeader(ostream& out)
+{
+    out << "file";
+    for(int f=0; f<F_COUNT; ++f)
+        for(int i=0; i<pilotfields[f].count; ++i)
+            out << "," << columnName(f, i);
+    out << "\n";
+}
+
+/**
+ * Print one pilot as CSV line.
+ */
+void writeCSV(ostream& out, const CompactPilot& p, const string& name)
+{
+    csvQuote(out, name.data(), name.size());
+    for(int f=0; f<F_COUNT; ++f)
+        for(int i=0; i<pilotfields[f].count; ++i)
+            out << "," << p.get(PilotFieldId(f), i);
+    out << "\n";
+}
+
+/**
+ * Column export for tfrdump query. The directory holds
+ * - columns.meta: a text file with the format version, number of rows and all columns with their width in BYTEs,
+ * - <column>.col: the values of one column in host byte order, using the width of the field,
+ * - <column>.zone: minimum and maximum of every block of BLOCKROWS rows as DWORD pairs,
+ * - file.dat and file.idx: the input filenames and their start offsets in file.dat (uint64_t, rows + 1 entries).
+ */
+class ColumnWriter {
+public:
+    static const size_t BLOCKROWS = 1024;
+
+    explicit ColumnWriter(const string&);
+    bool open();
+    void append(const CompactPilot&, const string&);
+    bool close();
+
+private:
+    struct Column {
+        PilotFieldId field;
+        int index;
+        string name;
+        ofstream data;
+        ofstream zone;
+    };
+
+    string dir;
+    size_t rows;
+    vector<unique_ptr<Column> > columns;
+    vector<DWORD> block;	// values of the current block, column after column
+    ofstream names;
+    ofstream nameindex;
+    uint64_t nameoffset;
+
+    void write_block();
+};
+
+ColumnWriter::ColumnWriter(const string& dir) : dir(dir), rows(0), nameoffset(0)
+{
+}
+
+bool ColumnWriter::open()
+{
+    if(mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+        return false;
+    for(int f=0; f<F_COUNT; ++f) {
+        for(int i=0; i<pilotfields[f].count; ++i) {
+            unique_ptr<Column> column(new Column);
+            column->field = PilotFieldId(f);
+            column->index = i;
+            column->name = columnName(f, i);
+            column->data.open((dir + "/" + column->name + ".col").c_str(), ios::out|ios::binary|ios::trunc);
+            column->zone.open((dir + "/" + column->name + ".zone").c_str(), ios::out|ios::binary|ios::trunc);
+            if(!column->data.is_open() || !column->zone.is_open())
+                return false;
+            columns.push_back(move(column));
+        }
+    }
+    block.resize(columns.size() * BLOCKROWS);
+    names.open((dir + "/file.dat").c_str(), ios::out|ios::binary|ios::trunc);
+    nameindex.open((dir + "/file.idx").c_str(), ios::out|ios::binary|ios::trunc);
+    nameindex.write((const char*) &nameoffset, sizeof(nameoffset));
+    return names.is_open() && nameindex.is_open();
+}
+
+void ColumnWriter::append(const CompactPilot& p, const string& name)
+{
+    size_t row = rows % BLOCKROWS;
+    for(size_t c=0; c<columns.size(); ++c)
+        block[c * BLOCKROWS + row] = p.get(columns[c]->field, columns[c]->index);
+    names.write(name.data(), name.size());
+    nameoffset += name.size();
+    nameindex.write((const char*) &nameoffset, sizeof(nameoffset));
+    if(++rows % BLOCKROWS == 0)
+        write_block();
+}
+
+/**
+ * Store values narrowed to T.
+ */
+template<typename T>
+void writeColumnValues(ostream& out, const DWORD* values, size_t n)
+{
+    T narrow[ColumnWriter::BLOCKROWS];
+    for(size_t i=0; i<n; ++i)
+        narrow[i] = values[i];
+    out.write((const char*) narrow, n * sizeof(T));
+}
+
+/**
+ * Append the current block to all column files together with its zone map entry.
+ */
+void ColumnWriter::write_block()
+{
+    size_t n = rows % BLOCKROWS ? rows % BLOCKROWS : BLOCKROWS;
+    for(size_t c=0; c<columns.size(); ++c) {
+        const DWORD* values = &block[c * BLOCKROWS];
+        DWORD zone[2];
+        minMax(values, n, zone[0], zone[1]);
+        columns[c]->zone.write((const char*) zone, sizeof(zone));
+        switch(pilotfields[columns[c]->field].width) {
+        case 1:
+            writeColumnValues<BYTE>(columns[c]->data, values, n);
+            break;
+        case 2:
+            writeColumnValues<WORD>(columns[c]->data, values, n);
+            break;
+        default:
+            writeColumnValues<DWORD>(columns[c]->data, values, n);
+        }
+    }
+}
+
+/**
+ * Write the last partial block and the meta file, which is written last so a crashed export can't be queried.
+ */
+bool ColumnWriter::close()
+{
+    if(rows % BLOCKROWS)
+        write_block();
+    bool ok = !names.fail() && !nameindex.fail();
+    for(size_t c=0; c<columns.size(); ++c) {
+        columns[c]->data.close();
+        columns[c]->zone.close();
+        ok &= !columns[c]->data.fail() && !columns[c]->zone.fail();
     }
-    Pilot p(argv[1]);
-    cout << p << endl;
-}
\ No newline at end of file
+    names.close();
+    nameindex.close();
+
+    ofstream meta((dir + "/columns.meta").c_str(), ios::out|ios::trunc);
+    meta << "tfrdump-columns 1" << endl
+         << "rows " << rows << endl
+         << "blockrows " << BLOCKROWS << endl;
+    for(size_t c=0; c<columns.size(); ++c)
+        meta << "column " << columns[c]->name << " " << (int) pilotfields[columns[c]->field].width << endl;
+    meta.close();
+    return ok && !meta.fail();
+}
+
+/**
+ * SQL export: CREATE TABLE statements and batched multi-row INSERTs for PostgreSQL and SQLite, or a psql script with
+ * COPY ... FROM stdin sections in PostgreSQL's text format.
+ * Scalars and short arrays are columns of the table pilots (arrays as name_0, name_1, ... like in the CSV export),
+ * arrays with more than CHILDTABLEMIN elements (kills, trainingpoints, battlepoints) get a child table
+ * (pilot_id, idx, value) each, which only holds the non-zero elements.
+ */
+class SQLWriter {
+public:
+    enum Dialect { INSERT, PGCOPY };
+
+    static const int CHILDTABLEMIN = 16;
+
+    explicit SQLWriter(Dialect);
+    static void schema(ostream&);
+    void begin(ostream&);
+    void append(ostream&, const CompactPilot&, const string&);
+    void end(ostream&);
+
+private:
+    struct Table {
+        string name;
+        string columns;
+        ostringstream rows;
+        size_t count;
+    };
+
+    Dialect dialect;
+    size_t batchrows;
+    size_t id;
+    vector<unique_ptr<Table> > tables;	// pilots first, then one per child table field
+    vector<int> childfields;
+
+    void add_row(ostream&, Table&, const string&);
+    void flush(ostream&, Table&);
+};
+
+SQLWriter::SQLWriter(Dialect dialect) : dialect(dialect), batchrows(dialect == INSERT ? 500 : 10000), id(0)
+{
+}
+
+/**
+ * SQL type for a field of the given width, DWORDs exceed a signed 32 bit INTEGER.
+ */
+const char* sqlType(int width)
+{
+    return width == 4 ? "BIGINT" : width == 2 ? "INTEGER" : "SMALLINT";
+}
+
+/**
+ * Quote a string as SQL literal.
+ */
+string sqlQuote(const string& s)
+{
+    string quoted = "'";
+    for(size_t i=0; i<s.size(); ++i) {
+        if(s[i] == '\'')
+            quoted += '\'';
+        quoted += s[i];
+    }
+    return quoted + "'";
+}
+
+/**
+ * Escape a string for PostgreSQL's COPY text format.
+ */
+string copyEscape(const string& s)
+{
+    string escaped;
+    for(size_t i=0; i<s.size(); ++i) {
+        switch(s[i]) {
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\t':
+            escaped += "\\t";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        case '\r':
+            escaped += "\\r";
+            break;
+        default:
+            escaped += s[i];
+        }
+    }
+    return escaped;
+}
+
+/**
+ * Write the CREATE TABLE statements.
+ */
+void SQLWriter::schema(ostream& out)
+{
+    out << "CREATE TABLE pilots (\n    id INTEGER PRIMARY KEY,\n    file TEXT NOT NULL";
+    for(int f=0; f<F_COUNT; ++f) {
+        if(pilotfields[f].count > CHILDTABLEMIN)
+            continue;
+        for(int i=0; i<pilotfields[f].count; ++i)
+            out << ",\n    " << columnName(f, i) << " " << sqlType(pilotfields[f].width) << " NOT NULL";
+    }
+    out << "\n);\n";
+    for(int f=0; f<F_COUNT; ++f) {
+        if(pilotfields[f].count <= CHILDTABLEMIN)
+            continue;
+        out << "CREATE TABLE " << pilotfields[f].name << " (\n"
+            << "    pilot_id INTEGER NOT NULL REFERENCES pilots(id),\n"
+            << "    idx SMALLINT NOT NULL,\n"
+            << "    value " << sqlType(pilotfields[f].width) << " NOT NULL,\n"
+            << "    PRIMARY KEY (pilot_id, idx)\n);\n";
+    }
+}
+
+/**
+ * Write the schema and start the transaction.
+ */
+void SQLWriter::begin(ostream& out)
+{
+    schema(out);
+    unique_ptr<Table> pilots(new Table);
+    pilots->name = "pilots";
+    pilots->columns = "id, file";
+    pilots->count = 0;
+    for(int f=0; f<F_COUNT; ++f) {
+        if(pilotfields[f].count > CHILDTABLEMIN) {
+            childfields.push_back(f);
+            continue;
+        }
+        for(int i=0; i<pilotfields[f].count; ++i)
+            pilots->columns += ", " + columnName(f, i);
+    }
+    tables.push_back(move(pilots));
+
+    for(size_t c=0; c<childfields.size(); ++c) {
+        unique_ptr<Table> child(new Table);
+        child->name = pilotfields[childfields[c]].name;
+        child->columns = "pilot_id, idx, value";
+        child->count = 0;
+        tables.push_back(move(child));
+    }
+    out << "BEGIN;\n";
+}
+
+void SQLWriter::append(ostream& out, const CompactPilot& p, const string& name)
+{
+    ++id;
+    ostringstream row;
+    if(dialect == INSERT)
+        row << "(" << id << ", " << sqlQuote(name);
+    else
+        row << id << "\t" << copyEscape(name);
+    for(int f=0; f<F_COUNT; ++f) {
+        if(pilotfields[f].count > CHILDTABLEMIN)
+            continue;
+        for(int i=0; i<pilotfields[f].count; ++i)
+            row << (dialect == INSERT ? ", " : "\t") << p.get(PilotFieldId(f), i);
+    }
+    if(dialect == INSERT)
+        row << ")";
+    add_row(out, *tables[0], row.str());
+
+    for(size_t c=0; c<childfields.size(); ++c) {
+        for(int i=0; i<pilotfields[childfields[c]].count; ++i) {
+            DWORD value = p.get(PilotFieldId(childfields[c]), i);
+            if(!value)
+                continue;
+            row.str("");
+            if(dialect == INSERT)
+                row << "(" << id << ", " << i << ", " << value << ")";
+            else
+                row << id << "\t" << i << "\t" << value;
+            add_row(out, *tables[c+1], row.str());
+        }
+    }
+}
+
+void SQLWriter::add_row(ostream& out, Table& table, const string& row)
+{
+    if(dialect == INSERT)
+        table.rows << (table.count ? ",\n" : "") << row;
+    else
+        table.rows << row << "\n";
+    if(++table.count == batchrows) {
+        if(&table != tables[0].get())
+            flush(out, *tables[0]);	// parents first, so the REFERENCES constraint holds
+        flush(out, table);
+    }
+}
+
+/**
+ * Write the collected rows of table as one INSERT statement or COPY section.
+ */
+void SQLWriter::flush(ostream& out, Table& table)
+{
+    if(!table.count)
+        return;
+    if(dialect == INSERT)
+        out << "INSERT INTO " << table.name << " (" << table.columns << ") VALUES\n" << table.rows.str() << ";\n";
+    else
+        out << "COPY " << table.name << " (" << table.columns << ") FROM stdin;\n" << table.rows.str() << "\\.\n";
+    table.rows.str("");
+    table.count = 0;
+}
+
+void SQLWriter::end(ostream& out)
+{
+    for(size_t t=0; t<tables.size(); ++t)
+        flush(out, *tables[t]);
+    out << "COMMIT;\n";
+}
+
+#ifdef TFRDUMP_WITH_SQLITE
+/**
+ * Write pilots directly into a SQLite database with the schema of SQLWriter. Uses prepared statements, WAL mode and
+ * one transaction per TRANSACTIONROWS pilots; it runs on the writer thread of its Sink.
+ */
+class SQLiteWriter {
+public:
+    static const size_t TRANSACTIONROWS = 10000;
+
+    explicit SQLiteWriter(const string&);
+    ~SQLiteWriter();
+    bool open();
+    bool append(const CompactPilot&, const string&);
+    bool close();
+
+private:
+    string path;
+    sqlite3* db;
+    sqlite3_stmt* pilotinsert;
+    vector<sqlite3_stmt*> childinserts;
+    vector<int> childfields;
+    size_t id;
+
+    bool exec(const string&);
+    bool step(sqlite3_stmt*);
+};
+
+SQLiteWriter::SQLiteWriter(const string& path) : path(path), db(0), pilotinsert(0), id(0)
+{
+}
+
+SQLiteWriter::~SQLiteWriter()
+{
+    sqlite3_finalize(pilotinsert);
+    for(size_t c=0; c<childinserts.size(); ++c)
+        sqlite3_finalize(childinserts[c]);
+    sqlite3_close(db);
+}
+
+bool SQLiteWriter::exec(const string& sql)
+{
+    if(sqlite3_exec(db, sql.c_str(), 0, 0, 0) == SQLITE_OK)
+        return true;
+    cerr << "SQLite error in " << path << ": " << sqlite3_errmsg(db) << endl;
+    return false;
+}
+
+bool SQLiteWriter::step(sqlite3_stmt* statement)
+{
+    int result = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if(result == SQLITE_DONE)
+        return true;
+    cerr << "SQLite error in " << path << ": " << sqlite3_errmsg(db) << endl;
+    return false;
+}
+
+/**
+ * Create the database and tables and prepare the INSERT statements.
+ */
+bool SQLiteWriter::open()
+{
+    if(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, 0) != SQLITE_OK) {
+        cerr << "SQLite error in " << path << ": " << sqlite3_errmsg(db) << endl;
+        return false;
+    }
+    ostringstream schema;
+    SQLWriter::schema(schema);
+    if(!exec("PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;") || !exec(schema.str()))
+        return false;
+
+    string columns = "id, file", values = "?, ?";
+    for(int f=0; f<F_COUNT; ++f) {
+        if(pilotfields[f].count > SQLWriter::CHILDTABLEMIN) {
+            childfields.push_back(f);
+            continue;
+        }
+        for(int i=0; i<pilotfields[f].count; ++i) {
+            columns += ", " + columnName(f, i);
+            values += ", ?";
+        }
+    }
+    string sql = "INSERT INTO pilots (" + columns + ") VALUES (" + values + ")";
+    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &pilotinsert, 0) != SQLITE_OK)
+        return exec(sql);	// reports the error
+    for(size_t c=0; c<childfields.size(); ++c) {
+        sql = string("INSERT INTO ") + pilotfields[childfields[c]].name + " (pilot_id, idx, value) VALUES (?, ?, ?)";
+        childinserts.push_back(0);
+        if(sqlite3_prepare_v2(db, sql.c_str(), -1, &childinserts.back(), 0) != SQLITE_OK)
+            return exec(sql);
+    }
+    return exec("BEGIN");
+}
+
+bool SQLiteWriter::append(const CompactPilot& p, const string& name)
+{
+    ++id;
+    int column = 1;
+    sqlite3_bind_int64(pilotinsert, column++, id);
+    sqlite3_bind_text(pilotinsert, column++, name.data(), name.size(), SQLITE_STATIC);
+    for(int f=0; f<F_COUNT; ++f) {
+        if(pilotfields[f].count > SQLWriter::CHILDTABLEMIN)
+            continue;
+        for(int i=0; i<pilotfields[f].count; ++i)
+            sqlite3_bind_int64(pilotinsert, column++, p.get(PilotFieldId(f), i));
+    }
+    if(!step(pilotinsert))
+        return false;
+
+    for(size_t c=0; c<childfields.size(); ++c) {
+        for(int i=0; i<pilotfields[childfields[c]].count; ++i) {
+            DWORD value = p.get(PilotFieldId(childfields[c]), i);
+            if(!value)
+                continue;
+            sqlite3_bind_int64(childinserts[c], 1, id);
+            sqlite3_bind_int(childinserts[c], 2, i);
+            sqlite3_bind_int64(childinserts[c], 3, value);
+            if(!step(childinserts[c]))
+                return false;
+        }
+    }
+    if(id % TRANSACTIONROWS == 0)
+        return exec("COMMIT; BEGIN");
+    return true;
+}
+
+bool SQLiteWriter::close()
+{
+    return exec("COMMIT");
+}
+#endif
+
+/**
+ * A blocking FIFO with a maximum size. Producers wait while it is full, consumers wait while it is empty.
+ * After close() pop() drains the remaining items and then returns false.
+ */
+template<typename T>
+class BoundedQueue {
+private:
+    deque<T> items;
+    size_t capacity;
+    bool closed;
+    mutex lock;
+    condition_variable notfull;
+    condition_variable notempty;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    void push(T item)
+    {
+        unique_lock<mutex> guard(lock);
+        notfull.wait(guard, [this] { return items.size() < this->capacity; });
+        items.push_back(move(item));
+        notempty.notify_one();
+    }
+
+    bool pop(T& item)
+    {
+        unique_lock<mutex> guard(lock);
+        notempty.wait(guard, [this] { return !items.empty() || closed; });
+        if(items.empty())
+            return false;
+        item = move(items.front());
+        items.pop_front();
+        notfull.notify_one();
+        return true;
+    }
+
+    /**
+     * pop() which gives up after timeout and then sets idle.
+     */
+    bool pop(T& item, chrono::milliseconds timeout, bool& idle)
+    {
+        unique_lock<mutex> guard(lock);
+        idle = !notempty.wait_for(guard, timeout, [this] { return !items.empty() || closed; });
+        if(items.empty())
+            return false;
+        item = move(items.front());
+        items.pop_front();
+        notfull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notempty.notify_all();
+    }
+};
+
+/**
+ * NUMA nodes and their CPUs from /sys/devices/system/node, limited to the CPUs this process may run on.
+ * Without sysfs (or NUMA) everything is one node with all CPUs.
+ */
+class NumaTopology {
+public:
+    static const NumaTopology& get()
+    {
+        static NumaTopology topology;
+        return topology;
+    }
+
+    size_t nodes() const
+    {
+        return cpus.size();
+    }
+
+    const vector<int>& nodeCpus(size_t node) const
+    {
+        return cpus[node];
+    }
+
+    /**
+     * Restrict the calling thread to the CPUs of node, so the memory it touches first is allocated there.
+     * Does nothing on single node machines.
+     */
+    void bind(size_t node) const
+    {
+#ifdef __linux__
+        if(nodes() < 2)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(size_t i=0; i<cpus[node].size(); ++i)
+            CPU_SET(cpus[node][i], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
+
+private:
+    vector<vector<int> > cpus;
+
+    NumaTopology()
+    {
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            for(int c=0; c<CPU_SETSIZE; ++c)
+                CPU_SET(c, &allowed);
+        for(int node=0; ; ++node) {
+            ostringstream path;
+            path << "/sys/devices/system/node/node" << node << "/cpulist";
+            ifstream list(path.str().c_str());
+            if(!list.is_open())
+                break;
+            string ranges;
+            getline(list, ranges);
+            vector<int> node_cpus = parseCpuList(ranges);
+            node_cpus.erase(remove_if(node_cpus.begin(), node_cpus.end(),
+                                      [&allowed](int c) { return c >= CPU_SETSIZE || !CPU_ISSET(c, &allowed); }),
+                            node_cpus.end());
+            if(!node_cpus.empty())	// memory only nodes or nodes we may not run on
+                cpus.push_back(node_cpus);
+        }
+#endif
+        if(cpus.empty())
+            cpus.push_back(vector<int>());
+    }
+
+    /**
+     * Parse a kernel CPU list like "0-15,32-47".
+     */
+    static vector<int> parseCpuList(const string& ranges)
+    {
+        vector<int> result;
+        istringstream in(ranges);
+        string range;
+        while(getline(in, range, ',')) {
+            if(range.empty())
+                continue;
+            int first = atoi(range.c_str());
+            size_t dash = range.find('-');
+            int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+            for(int c=first; c<=last; ++c)
+                result.push_back(c);
+        }
+        return result;
+    }
+};
+
+/**
+ * A fixed number of worker threads processing submitted tasks in FIFO order.
+ * On NUMA machines the workers are spread over the nodes and bound to them, every node has its own queue.
+ * Tasks go to the queue of the submitting thread's node, so they run where their data was touched first;
+ * idle workers take from their own node first and only steal from other nodes when it is empty.
+ */
+class ThreadPool {
+private:
+    vector<thread> workers;
+    vector<deque<function<void()> > > queues;	// one per NUMA node
+    vector<size_t> idle;	// waiting workers per node
+    vector<size_t> signaled;	// of those already woken for a new task
+    vector<condition_variable> wakeups;	// per node
+    bool stopping;
+    size_t nextnode;	// for submitters which are not bound to a node
+    uint64_t tasks;
+    uint64_t steals;	// tasks run on another node than they were queued for
+    mutable mutex lock;
+
+    static thread_local int currentnode;
+
+    void run(size_t node);
+    void enqueue(function<void()>, int);
+
+public:
+    explicit ThreadPool(size_t);
+    ~ThreadPool();
+
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+    size_t nodes() const
+    {
+        return queues.size();
+    }
+
+    /**
+     * Bind the calling (non-pool) thread to node, its memory and submitted tasks stay there.
+     */
+    static void bindToNode(size_t node)
+    {
+        NumaTopology::get().bind(node);
+        currentnode = node;
+    }
+
+    /**
+     * Number of tasks run so far and how many of them were stolen by a worker of another node.
+     */
+    void counts(uint64_t& total, uint64_t& crossnode) const
+    {
+        lock_guard<mutex> guard(lock);
+        total = tasks;
+        crossnode = steals;
+    }
+
+    /**
+     * Queue task for execution, the future delivers its result.
+     */
+    template<typename F>
+    future<decltype(declval<F&>()())> submit(F task)
+    {
+        typedef decltype(declval<F&>()()) R;	// not result_of, which C++20 removed
+        shared_ptr<packaged_task<R()> > job = make_shared<packaged_task<R()> >(task);
+        future<R> result = job->get_future();
+        enqueue([job] { (*job)(); }, currentnode);
+        return result;
+    }
+};
+
+thread_local int ThreadPool::currentnode = -1;
+
+ThreadPool::ThreadPool(size_t threads)
+    : queues(NumaTopology::get().nodes()), idle(queues.size()), signaled(queues.size()), wakeups(queues.size()),
+      stopping(false), nextnode(0), tasks(0), steals(0)
+{
+    for(size_t i=0; i<max(threads, (size_t) 1); ++i)
+        workers.push_back(thread(&ThreadPool::run, this, i % queues.size()));
+}
+
+/**
+ * Finish all queued tasks, then stop the workers.
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        for(size_t n=0; n<wakeups.size(); ++n)
+            wakeups[n].notify_all();
+    }
+    for(size_t i=0; i<workers.size(); ++i)
+        workers[i].join();
+}
+
+/**
+ * Queue a task on node (round robin for unbound submitters) and wake a worker, preferably one of that node.
+ */
+void ThreadPool::enqueue(function<void()> task, int node)
+{
+    lock_guard<mutex> guard(lock);
+    size_t target = node >= 0 ? node % queues.size() : nextnode++ % queues.size();
+    queues[target].push_back(move(task));
+    for(size_t i=0; i<queues.size(); ++i) {
+        size_t n = (target + i) % queues.size();
+        if(idle[n] > signaled[n]) {
+            ++signaled[n];
+            wakeups[n].notify_one();
+            return;
+        }
+    }
+}
+
+void ThreadPool::run(size_t node)
+{
+    bindToNode(node);
+    for(;;) {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(lock);
+            for(;;) {
+                size_t victim = node;
+                for(size_t i=0; i<queues.size() && queues[victim].empty(); ++i)
+                    victim = (node + i + 1) % queues.size();
+                if(!queues[victim].empty()) {
+                    task = move(queues[victim].front());
+                    queues[victim].pop_front();
+                    ++tasks;
+                    if(victim != node)
+                        ++steals;
+                    break;
+                }
+                if(stopping)
+                    return;
+                ++idle[node];
+                wakeups[node].wait(guard);
+                --idle[node];
+                if(signaled[node])
+                    --signaled[node];
+            }
+        }
+        task();
+    }
+}
+
+enum Compression { COMPRESS_NONE, COMPRESS_GZIP, COMPRESS_ZSTD };
+
+/**
+ * Parse "gzip[:level]" or "zstd[:level]", without a level the method's default is used. gzip takes levels 0 - 9, zstd
+ * also its negative fast levels. Fails for invalid levels and for methods which were not compiled in.
+ */
+bool parseCompression(const string& spec, Compression& method, int& level)
+{
+    size_t colon = spec.find(':');
+    string name = spec.substr(0, colon);
+    bool leveled = colon != string::npos;
+    char* end = 0;
+    level = leveled ? strtol(spec.c_str() + colon + 1, &end, 10) : 0;
+    if(leveled && (end == spec.c_str() + colon + 1 || *end))
+        return false;
+#ifdef TFRDUMP_WITH_ZLIB
+    if(name == "gzip") {
+        method = COMPRESS_GZIP;
+        if(!leveled)
+            level = Z_DEFAULT_COMPRESSION;
+        return !leveled || (level >= 0 && level <= 9);
+    }
+#endif
+#ifdef TFRDUMP_WITH_ZSTD
+    if(name == "zstd") {
+        method = COMPRESS_ZSTD;
+        if(!leveled)
+            level = ZSTD_CLEVEL_DEFAULT;
+        return !leveled || (level >= ZSTD_minCLevel() && level <= ZSTD_maxCLevel());
+    }
+#endif
+#if !defined(TFRDUMP_WITH_ZLIB) && !defined(TFRDUMP_WITH_ZSTD)
+    (void) method;
+#endif
+    return false;
+}
+
+/**
+ * Compress data into one self-contained gzip member or zstd frame. Returns an empty string on errors.
+ */
+string compressBlock(Compression method, int level, const string& data)
+{
+#if !defined(TFRDUMP_WITH_ZLIB) && !defined(TFRDUMP_WITH_ZSTD)
+    (void) level;
+#endif
+    string packed;
+    switch(method) {
+#ifdef TFRDUMP_WITH_ZLIB
+    case COMPRESS_GZIP: {
+        z_stream zs = z_stream();
+        if(deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)	// 15 + 16: gzip header
+            return "";
+        packed.resize(deflateBound(&zs, data.size()) + 32);
+        zs.next_in = (Bytef*) data.data();
+        zs.avail_in = data.size();
+        zs.next_out = (Bytef*) &packed[0];
+        zs.avail_out = packed.size();
+        int result = deflate(&zs, Z_FINISH);
+        packed.resize(zs.total_out);
+        deflateEnd(&zs);
+        if(result != Z_STREAM_END)
+            return "";
+        break;
+    }
+#endif
+#ifdef TFRDUMP_WITH_ZSTD
+    case COMPRESS_ZSTD: {
+        packed.resize(ZSTD_compressBound(data.size()));
+        size_t size = ZSTD_compress(&packed[0], packed.size(), data.data(), data.size(), level);
+        if(ZSTD_isError(size))
+            return "";
+        packed.resize(size);
+        break;
+    }
+#endif
+    default:
+        return data;
+    }
+    return packed;
+}
+
+/**
+ * Allocation profiler, compiled in with -DTFRDUMP_ALLOC_PROFILE. Replaces all forms of the global operator new and
+ * delete and counts allocations and their bytes for the phase the allocating thread is in (see setAllocationPhase() and
+ * Stats::Phase), --stats prints them and fails if reading or decoding allocated. The phase tags cost nothing in normal
+ * builds.
+ */
+const int ALLOCATIONPHASES = 5;	// Stats::PHASECOUNT + everything outside the measured phases
+
+#ifdef TFRDUMP_ALLOC_PROFILE
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+thread_local int allocationPhase = ALLOCATIONPHASES - 1;
+atomic<uint64_t> allocationCount[ALLOCATIONPHASES];
+atomic<uint64_t> allocationBytes[ALLOCATIONPHASES];
+
+inline void setAllocationPhase(int phase)
+{
+    allocationPhase = phase;
+}
+
+void* profiledAllocate(size_t size, size_t alignment) noexcept
+{
+    allocationCount[allocationPhase].fetch_add(1, memory_order_relaxed);
+    allocationBytes[allocationPhase].fetch_add(size, memory_order_relaxed);
+    if(alignment <= alignof(max_align_t))
+        return malloc(size ? size : 1);
+    void* p;
+    return posix_memalign(&p, alignment, size ? size : 1) ? 0 : p;
+}
+
+void* operator new(size_t size)
+{
+    void* p = profiledAllocate(size, 0);
+    if(!p)
+        throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    return profiledAllocate(size, 0);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    return profiledAllocate(size, 0);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, align_val_t alignment)
+{
+    void* p = profiledAllocate(size, (size_t) alignment);
+    if(!p)
+        throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return profiledAllocate(size, (size_t) alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return profiledAllocate(size, (size_t) alignment);
+}
+
+void operator delete(void* p, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept
+{
+    free(p);
+}
+#endif
+#else
+inline void setAllocationPhase(int) {}
+#endif
+
+/**
+ * Hardware performance counters of the calling thread (user space only) via perf_event_open, read as one group.
+ * Counters the kernel does not allow or the CPU does not have just stay zero; without any counters only times are
+ * reported (see /proc/sys/kernel/perf_event_paranoid).
+ */
+class PerfCounters {
+public:
+    enum Event { CYCLES, INSTRUCTIONS, L1DMISSES, LLCMISSES, BRANCHMISSES, EVENTCOUNT };
+
+    PerfCounters() : leader(-1), opened(0)
+    {
+        fill(fds, fds + EVENTCOUNT, -1);
+    }
+
+    ~PerfCounters()
+    {
+        for(int e=0; e<EVENTCOUNT; ++e)
+            if(fds[e] >= 0)
+                ::close(fds[e]);
+    }
+
+    /**
+     * Start counting for the calling thread.
+     */
+    bool open()
+    {
+#ifdef __linux__
+        const uint32_t types[EVENTCOUNT] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+        };
+        const uint64_t configs[EVENTCOUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for(int e=0; e<EVENTCOUNT; ++e) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[e];
+            attr.config = configs[e];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if(fds[e] < 0)
+                continue;
+            if(leader < 0)
+                leader = fds[e];
+            order[opened++] = Event(e);
+        }
+#endif
+        return leader >= 0;
+    }
+
+    bool available() const
+    {
+        return leader >= 0;
+    }
+
+    /**
+     * Current counts since open().
+     */
+    void read(uint64_t values[EVENTCOUNT]) const
+    {
+        fill(values, values + EVENTCOUNT, 0);
+        uint64_t group[1 + EVENTCOUNT];
+        if(leader < 0 || ::read(leader, group, sizeof(group)) < (ssize_t) sizeof(uint64_t))
+            return;
+        for(uint64_t i=0; i<group[0] && i<opened; ++i)
+            values[order[i]] = group[1 + i];
+    }
+
+private:
+    int fds[EVENTCOUNT];
+    Event order[EVENTCOUNT];	// group members in read order
+    int leader;
+    size_t opened;
+};
+
+/**
+ * Time and counters at one point of a thread, the difference of two samples is what a phase cost.
+ */
+struct StatsSample {
+    chrono::steady_clock::time_point time;
+    uint64_t counters[PerfCounters::EVENTCOUNT];
+
+    void take(const PerfCounters& perf)
+    {
+        perf.read(counters);
+        time = chrono::steady_clock::now();
+    }
+};
+
+/**
+ * Collects --stats for the phases of the pipeline from all threads and prints them to stderr.
+ */
+class Stats {
+public:
+    enum Phase { READ, DECODE, FORMAT, WRITE, PHASECOUNT };
+
+    explicit Stats(bool perfile) : perfile(perfile), counters(false)
+    {
+        memset(phases, 0, sizeof(phases));
+    }
+
+    /**
+     * Account the cost between two samples of the same thread to phase.
+     */
+    void add(Phase phase, const StatsSample& from, const StatsSample& to)
+    {
+        lock_guard<mutex> guard(lock);
+        phases[phase].calls++;
+        phases[phase].seconds += chrono::duration<double>(to.time - from.time).count();
+        for(int e=0; e<PerfCounters::EVENTCOUNT; ++e)
+            phases[phase].counters[e] += to.counters[e] - from.counters[e];
+    }
+
+    /**
+     * Remember that at least one thread got hardware counters.
+     */
+    void counting(bool available)
+    {
+        lock_guard<mutex> guard(lock);
+        counters |= available;
+    }
+
+    /**
+     * Print one line per file with the cost of reading and decoding it (--stats=files).
+     */
+    void file(const string& name, const StatsSample& start, const StatsSample& read, const StatsSample& decoded)
+    {
+        if(!perfile)
+            return;
+        ostringstream line;
+        line << name << "\tread " << chrono::duration<double, micro>(read.time - start.time).count() << " us";
+        if(counters)
+            line << ", " << read.counters[PerfCounters::CYCLES] - start.counters[PerfCounters::CYCLES] << " cycles, "
+                 << read.counters[PerfCounters::INSTRUCTIONS] - start.counters[PerfCounters::INSTRUCTIONS] << " instructions";
+        line << "\tdecode " << chrono::duration<double, micro>(decoded.time - read.time).count() << " us";
+        if(counters)
+            line << ", " << decoded.counters[PerfCounters::CYCLES] - read.counters[PerfCounters::CYCLES] << " cycles, "
+                 << decoded.counters[PerfCounters::INSTRUCTIONS] - read.counters[PerfCounters::INSTRUCTIONS] << " instructions";
+        cerr << line.str() << endl;
+    }
+
+    void print(ostream& out, const ThreadPool& pool)
+    {
+        const char* names[PHASECOUNT] = {"read", "decode", "format", "write"};
+        lock_guard<mutex> guard(lock);
+        out << "phase\tcalls\tseconds";
+        if(counters)
+            out << "\tcycles\tinstructions\tIPC\tL1D misses\tLLC misses\tbranch misses";
+#ifdef TFRDUMP_ALLOC_PROFILE
+        out << "\tallocations\tbytes";
+#endif
+        out << endl;
+        for(int p=0; p<PHASECOUNT; ++p) {
+            const PhaseStats& phase = phases[p];
+            out << names[p] << "\t" << phase.calls << "\t" << phase.seconds;
+            if(counters) {
+                const uint64_t* c = phase.counters;
+                out << "\t" << c[PerfCounters::CYCLES] << "\t" << c[PerfCounters::INSTRUCTIONS]
+                    << "\t" << (c[PerfCounters::CYCLES] ? (double) c[PerfCounters::INSTRUCTIONS] / c[PerfCounters::CYCLES] : 0.0)
+                    << "\t" << c[PerfCounters::L1DMISSES] << "\t" << c[PerfCounters::LLCMISSES]
+                    << "\t" << c[PerfCounters::BRANCHMISSES];
+            }
+#ifdef TFRDUMP_ALLOC_PROFILE
+            out << "\t" << allocationCount[p] << "\t" << allocationBytes[p];
+#endif
+            out << endl;
+        }
+#ifdef TFRDUMP_ALLOC_PROFILE
+        out << "other\t\t";
+        if(counters)
+            out << "\t\t\t\t\t\t";
+        out << "\t" << allocationCount[PHASECOUNT] << "\t" << allocationBytes[PHASECOUNT] << endl;
+#endif
+        if(!counters)
+            out << "(hardware counters not available, see /proc/sys/kernel/perf_event_paranoid)" << endl;
+        out << "kernels: " << kernelTarget() << endl;
+        uint64_t tasks, steals;
+        pool.counts(tasks, steals);
+        out << "numa: " << pool.nodes() << " node(s), " << pool.size() << " workers, " << tasks << " tasks, "
+            << steals << " cross-node steals" << endl;
+    }
+
+private:
+    struct PhaseStats {
+        uint64_t calls;
+        double seconds;
+        uint64_t counters[PerfCounters::EVENTCOUNT];
+    };
+
+    bool perfile;
+    bool counters;
+    PhaseStats phases[PHASECOUNT];
+    mutex lock;
+};
+
+/**
+ * A pilot decoded once and shared between all output sinks.
+ */
+struct DecodedPilot {
+    string name;
+    CompactPilot pilot;
+
+    DecodedPilot(const string& name, const BYTE* buffer, const Layout& layout) : name(name), pilot(buffer, layout) {}
+};
+
+/**
+ * Decoded pilots recycled between the reading thread and the sinks, so that decoding allocates neither the pilot nor
+ * its name. A slot is free again when the pool holds its only reference. Names longer than NAMECAPACITY grow their
+ * slot once; if every slot is in flight the pool falls back to allocating a new pilot.
+ */
+class DecodedPilotPool {
+public:
+    static const size_t NAMECAPACITY = 256;
+
+    explicit DecodedPilotPool(size_t size) : next(0)
+    {
+        const PilotBuffer empty = {};
+        const Layout& layout = *Layout::formats().front();	// also sets up formats() before the first detect()
+        for(size_t i=0; i<size; ++i) {
+            slots.push_back(make_shared<DecodedPilot>(string(), empty.data(), layout));
+            slots.back()->name.reserve(NAMECAPACITY);
+        }
+    }
+
+    shared_ptr<const DecodedPilot> decode(const string& name, const BYTE* buffer, const Layout& layout)
+    {
+        for(size_t i=0; i<slots.size(); ++i) {
+            shared_ptr<DecodedPilot>& slot = slots[next];
+            next = (next + 1) % slots.size();
+            if(slot.use_count() != 1)
+                continue;
+            atomic_thread_fence(memory_order_acquire);	// the last sink is done reading before the slot is overwritten
+            slot->name.assign(name);
+            slot->pilot = CompactPilot(buffer, layout);
+            return slot;
+        }
+        return make_shared<DecodedPilot>(name, buffer, layout);
+    }
+
+private:
+    vector<shared_ptr<DecodedPilot> > slots;
+    size_t next;	// slots are taken round robin, the oldest pilot is the most likely to be written
+};
+
+/**
+ * One output destination with its own format. Decoded pilots are queued by the reading thread,
+ * formatting and writing happens on a thread per sink, so several formats cost one read and one decode per file.
+ * Compressed sinks hand their blocks to the thread pool and write the results in submission order.
+ */
+class Sink {
+public:
+    enum Format { TEXT, JSON, CSV, COLUMNS, SQL, PGCOPY, SQLITE };
+
+    static const size_t QUEUESIZE = 256;	// pilots waiting per sink, see DecodedPilotPool
+
+    static bool parse(const string&, Format&, string&);
+
+    Sink(Format, const string&, bool, ThreadPool&, Compression = COMPRESS_NONE, int = 0);
+    ~Sink();
+    void measure(Stats*);
+    void place(size_t);
+    bool open();
+    void push(const shared_ptr<const DecodedPilot>&);
+    bool close();
+
+private:
+    static const size_t BLOCKSIZE = 1 << 16;	// write to the file in chunks of 64 KiB
+    static const size_t COMPRESSEDBLOCKSIZE = 1 << 20;	// compress in chunks of 1 MiB
+    static const int IDLEFLUSH = 100;	// ms without pilots after which uncompressed output is written, e.g. for slow stdin
+
+    Format format;
+    string path;
+    bool headers;	// text only: print the filename before every pilot
+    ofstream file;
+    ostream* out;
+    unique_ptr<ColumnWriter> columns;	// COLUMNS writes a directory instead of a stream
+    unique_ptr<SQLWriter> sql;
+#ifdef TFRDUMP_WITH_SQLITE
+    unique_ptr<SQLiteWriter> sqlite;	// SQLITE writes a database file instead of a stream
+#endif
+    ostringstream block;
+    size_t blocksize;
+    size_t count;
+    BoundedQueue<shared_ptr<const DecodedPilot> > queue;
+    thread writer;
+
+    ThreadPool& pool;
+    Compression compression;
+    int level;
+    deque<future<string> > pending;	// compressed blocks in output order
+    size_t blocks;
+    bool failed;
+    Stats* stats;	// --stats: time formatting and writing on the writer thread
+    size_t node;	// NUMA node of the writer thread, its blocks and their compression
+    PerfCounters perf;
+
+    void run();
+    void format_pilot(const DecodedPilot&);
+    void flush();
+    void write_pending();
+};
+
+/**
+ * Split an output specification "format[:path]" into its parts, the path defaults to stdout ("-").
+ */
+bool Sink::parse(const string& spec, Format& format, string& path)
+{
+    size_t colon = spec.find(':');
+    string name = spec.substr(0, colon);
+    path = colon == string::npos ? "-" : spec.substr(colon+1);
+    if(path.empty())
+        path = "-";
+    if(name == "text")
+        format = TEXT;
+    else if(name == "json")
+        format = JSON;
+    else if(name == "csv")
+        format = CSV;
+    else if(name == "columns")
+        format = COLUMNS;
+    else if(name == "sql")
+        format = SQL;
+    else if(name == "pgcopy")
+        format = PGCOPY;
+#ifdef TFRDUMP_WITH_SQLITE
+    else if(name == "sqlite")
+        format = SQLITE;
+#endif
+    else
+        return false;
+    return true;
+}
+
+Sink::Sink(Format format, const string& path, bool headers, ThreadPool& pool, Compression compression, int level)
+    : format(format), path(path), headers(headers), out(0),
+      blocksize(compression == COMPRESS_NONE ? BLOCKSIZE : COMPRESSEDBLOCKSIZE), count(0), queue(QUEUESIZE),
+      pool(pool), compression(compression), level(level), blocks(0), failed(false), stats(0), node(0)
+{
+}
+
+void Sink::measure(Stats* stats)
+{
+    this->stats = stats;
+}
+
+/**
+ * Run the writer thread on NUMA node, the blocks it formats are allocated there and compressed by its workers.
+ */
+void Sink::place(size_t node)
+{
+    this->node = node;
+}
+
+Sink::~Sink()
+{
+    if(writer.joinable())
+        close();
+}
+
+/**
+ * Open the destination, write the format header and start the writer thread.
+ */
+bool Sink::open()
+{
+    if(format == COLUMNS) {
+        columns.reset(new ColumnWriter(path));
+        if(!columns->open())
+            return false;
+        writer = thread(&Sink::run, this);
+        return true;
+    }
+#ifdef TFRDUMP_WITH_SQLITE
+    if(format == SQLITE) {
+        sqlite.reset(new SQLiteWriter(path));
+        if(!sqlite->open())
+            return false;
+        writer = thread(&Sink::run, this);
+        return true;
+    }
+#endif
+    if(path == "-") {
+        out = &cout;
+    } else {
+        file.open(path.c_str(), ios::out|ios::binary|ios::trunc);
+        if(!file.is_open())
+            return false;
+        out = &file;
+    }
+    if(format == JSON)
+        block << "[";
+    else if(format == CSV)
+        writeCSVHeader(block);
+    else if(format == SQL || format == PGCOPY) {
+        sql.reset(new SQLWriter(format == SQL ? SQLWriter::INSERT : SQLWriter::PGCOPY));
+        sql->begin(block);
+    }
+    writer = thread(&Sink::run, this);
+    return true;
+}
+
+void Sink::push(const shared_ptr<const DecodedPilot>& p)
+{
+    queue.push(p);
+}
+
+/**
+ * Wait until all queued pilots are written, finish the format and flush. Returns false on write errors.
+ */
+bool Sink::close()
+{
+    queue.close();
+    writer.join();
+    if(format == COLUMNS)
+        return columns->close();
+#ifdef TFRDUMP_WITH_SQLITE
+    if(format == SQLITE)
+        return !failed && sqlite->close();
+#endif
+    if(format == JSON)
+        block << (count ? "\n" : "") << "]\n";
+    else if(sql)
+        sql->end(block);
+    flush();
+    while(!pending.empty())
+        write_pending();
+    out->flush();
+    if(file.is_open())
+        file.close();
+    return !failed && !out->fail();
+}
+
+void Sink::run()
+{
+    ThreadPool::bindToNode(node);
+    if(stats)
+        stats->counting(perf.open());
+    StatsSample start, formatted, written;
+    shared_ptr<const DecodedPilot> p;
+    bool idle;
+    while(queue.pop(p, chrono::milliseconds((int) IDLEFLUSH), idle) || idle) {
+        if(idle) {
+            if(out && compression == COMPRESS_NONE && block.tellp() > 0) {
+                flush();
+                out->flush();
+            }
+            continue;
+        }
+        if(stats)
+            start.take(perf);
+        setAllocationPhase(Stats::FORMAT);
+        format_pilot(*p);
+        ++count;
+        setAllocationPhase(Stats::WRITE);
+        if(!stats) {
+            if(block.tellp() >= (streamoff) blocksize)
+                flush();
+            setAllocationPhase(Stats::PHASECOUNT);
+            continue;
+        }
+        formatted.take(perf);
+        stats->add(Stats::FORMAT, start, formatted);
+        if(block.tellp() >= (streamoff) blocksize) {
+            flush();
+            written.take(perf);
+            stats->add(Stats::WRITE, formatted, written);
+        }
+        setAllocationPhase(Stats::PHASECOUNT);
+    }
+}
+
+void Sink::format_pilot(const DecodedPilot& p)
+{
+    switch(format) {
+    case TEXT:
+        if(headers)
+            block << (count ? "\n" : "") << "==> " << p.name << " <==" << endl;
+        block << p.pilot << endl;
+        break;
+    case JSON:
+        block << (count ? ",\n" : "\n");
+        writeJSON(block, p.pilot, p.name);
+        break;
+    case CSV:
+        writeCSV(block, p.pilot, p.name);
+        break;
+    case COLUMNS:
+        columns->append(p.pilot, p.name);
+        break;
+    case SQL:
+    case PGCOPY:
+        sql->append(block, p.pilot, p.name);
+        break;
+    case SQLITE:
+#ifdef TFRDUMP_WITH_SQLITE
+        if(!failed && !sqlite->append(p.pilot, p.name))
+            failed = true;
+#endif
+        break;
+    }
+}
+
+/**
+ * Write the current block, or queue it for compression. An empty output still gets one (empty) compressed block,
+ * so the result is a valid gzip/zstd file.
+ */
+void Sink::flush()
+{
+    if(compression == COMPRESS_NONE) {
+        string data = block.str();
+        out->write(data.data(), data.size());
+        block.str("");
+        return;
+    }
+    if(block.tellp() == 0 && blocks)
+        return;
+    shared_ptr<string> data = make_shared<string>(block.str());
+    block.str("");
+    Compression method = compression;
+    int level = this->level;
+    pending.push_back(pool.submit([method, level, data] { return compressBlock(method, level, *data); }));
+    ++blocks;
+    while(pending.size() > 2 * pool.size())
+        write_pending();
+}
+
+/**
+ * Wait for the oldest compressed block and write it.
+ */
+void Sink::write_pending()
+{
+    string packed = pending.front().get();
+    pending.pop_front();
+    if(packed.empty())
+        failed = true;
+    out->write(packed.data(), packed.size());
+}
+
+/**
+ * --no-cache-pollution: read pilot files with O_DIRECT where the filesystem supports it and drop everything else that
+ * was read (archives, stdin) from the page cache, so a one-time scan does not evict the cache other programs rely on.
+ */
+bool nocachepollution = false;
+
+const size_t DIRECTBLOCK = 4096;	// O_DIRECT transfer size and alignment, holds a whole pilot file
+static_assert(DIRECTBLOCK >= PILOTFILESIZE, "a pilot file must fit into one O_DIRECT read");
+
+/**
+ * Read a pilot file into buffer and set size to the BYTEs read (at most PILOTFILESIZE, see Layout::detect()). Short
+ * files are padded with zeroes like a new pilot.
+ * Plain POSIX I/O, an ifstream would allocate its buffer for every file.
+ */
+bool readPilotFile(const string& filename, PilotBuffer& buffer, size_t& size)
+{
+    int flags = O_RDONLY;
+#ifdef O_DIRECT
+    if(nocachepollution)
+        flags |= O_DIRECT;
+#endif
+    int fd = ::open(filename.c_str(), flags);
+    if(fd < 0 && flags != O_RDONLY)	// e.g. tmpfs does not support O_DIRECT
+        fd = ::open(filename.c_str(), flags = O_RDONLY);
+    if(fd < 0)
+        return false;
+    size_t filled = 0;
+    bool ok = true;
+#ifdef O_DIRECT
+    if(flags & O_DIRECT) {
+        alignas(DIRECTBLOCK) static thread_local BYTE block[DIRECTBLOCK];
+        ssize_t n;
+        do
+            n = ::read(fd, block, DIRECTBLOCK);
+        while(n < 0 && errno == EINTR);
+        if(n >= 0) {
+            filled = min((size_t) n, buffer.size());
+            memcpy(buffer.data(), block, filled);
+            ::close(fd);
+            fill(buffer.begin() + filled, buffer.end(), 0x0);
+            size = filled;
+            return true;
+        }
+        // the filesystem refuses direct reads of this size, read through the page cache and drop it afterwards
+        ok = errno == EINVAL && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) == 0;
+    }
+#endif
+    while(ok && filled < buffer.size()) {
+        ssize_t n = ::read(fd, buffer.data() + filled, buffer.size() - filled);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        filled += n;
+    }
+    if(nocachepollution)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+    fill(buffer.begin() + filled, buffer.end(), 0x0);
+    size = filled;
+    return ok;
+}
+
+/**
+ * Check for the *.TFR extension or the extension of another known format, case insensitive.
+ */
+bool isPilotFilename(const string& name)
+{
+    return Layout::isKnownExtension(name);
+}
+
+/**
+ * Entry of a directory listing, type is the d_type of the filesystem (DT_UNKNOWN if it does not tell).
+ */
+struct DirectoryEntry {
+    string name;
+    unsigned char type;
+
+    bool operator<(const DirectoryEntry& other) const
+    {
+        return name < other.name;
+    }
+};
+
+/**
+ * Append all entries of the open directory fd except "." and "..". On Linux they are read with getdents64 into a
+ * large buffer, a few system calls for thousands of entries.
+ */
+bool listDirectory(int fd, vector<DirectoryEntry>& entries)
+{
+#ifdef SYS_getdents64
+    struct LinuxDirent64 {	// the kernel's struct linux_dirent64
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+    static thread_local vector<char> buffer(1 << 18);
+    for(;;) {
+        long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if(n <= 0)
+            return n == 0;
+        for(long pos=0; pos<n; ) {
+            const LinuxDirent64* d = (const LinuxDirent64*) (buffer.data() + pos);
+            pos += d->d_reclen;
+            if(strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+                DirectoryEntry entry = { d->d_name, d->d_type };
+                entries.push_back(entry);
+            }
+        }
+    }
+#else
+    DIR* dir = fdopendir(dup(fd));
+    if(!dir)
+        return false;
+    while(struct dirent* d = readdir(dir)) {
+        if(strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+            DirectoryEntry entry = { d->d_name, d->d_type };
+            entries.push_back(entry);
+        }
+    }
+    closedir(dir);
+    return true;
+#endif
+}
+
+/**
+ * Recursive search for *.TFR files on several threads. Every directory is opened relative to its parent (openat) when
+ * it is listed with listDirectory(); d_type tells directories from files, so only symlinks and entries of filesystems
+ * without d_type cost a stat. Subdirectories are queued for all walker threads, the result is put together in the same
+ * sorted depth-first order a sequential walk produces.
+ * A directory keeps its descriptor open until all its subdirectories are opened, at most MAXOPEN and a quarter of the
+ * descriptor limit at a time, beyond that subdirectories are opened by path. Every directory is listed once (by device and inode), so symlinks to a parent
+ * cannot loop; a directory reachable on several paths shows up under the one listed first.
+ */
+class PilotTreeWalker {
+private:
+    static const size_t MAXTHREADS = 8;	// the walk is bound by the filesystem, not the CPU
+    static const size_t MAXOPEN = 256;	// directory descriptors kept open for openat()
+
+    struct Directory {
+        string path;
+        Directory* parent;	// 0 for the root
+        int fd;	// kept open while subdirectories are to be opened, else -1 (open by path)
+        size_t pending;	// subdirectories not opened yet
+        vector<pair<string, Directory*> > entries;	// sorted, pilot files have no Directory
+    };
+
+    deque<Directory> directories;	// all directories found, deque for stable addresses
+    deque<Directory*> queue;	// not listed yet
+    set<pair<dev_t, ino_t> > visited;
+    size_t busy;	// threads listing a directory
+    size_t open;	// directory descriptors kept open
+    size_t maxopen;
+    mutex lock;
+    condition_variable wakeup;
+
+    void run();
+    void list(Directory&, vector<Directory*>&);
+    void flatten(const Directory&, vector<string>&) const;
+
+public:
+    PilotTreeWalker() : busy(0), open(0), maxopen(MAXOPEN)
+    {
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+            maxopen = min<rlim_t>(maxopen, limit.rlim_cur / 4);
+    }
+
+    void walk(const string&, vector<string>&);
+};
+
+/**
+ * Append all *.TFR files below the directory root to files.
+ */
+void PilotTreeWalker::walk(const string& root, vector<string>& files)
+{
+    Directory start = { root, 0, -1, 0, vector<pair<string, Directory*> >() };
+    directories.push_back(start);
+    queue.push_back(&directories.back());
+    vector<thread> threads;
+    for(size_t i=1; i<min((size_t) thread::hardware_concurrency(), (size_t) MAXTHREADS); ++i)
+        threads.push_back(thread(&PilotTreeWalker::run, this));
+    run();
+    for(size_t i=0; i<threads.size(); ++i)
+        threads[i].join();
+    flatten(directories.front(), files);
+}
+
+void PilotTreeWalker::run()
+{
+    unique_lock<mutex> guard(lock);
+    for(;;) {
+        wakeup.wait(guard, [this] { return !queue.empty() || busy == 0; });
+        if(queue.empty())
+            return;
+        Directory* dir = queue.front();
+        queue.pop_front();
+        ++busy;
+        guard.unlock();
+        vector<Directory*> children;
+        list(*dir, children);
+        guard.lock();
+        queue.insert(queue.end(), children.begin(), children.end());
+        --busy;
+        wakeup.notify_all();
+    }
+}
+
+/**
+ * Open and list dir, return its subdirectories in children.
+ */
+void PilotTreeWalker::list(Directory& dir, vector<Directory*>& children)
+{
+    Directory* parent = dir.parent;
+    int fd;
+    if(parent && parent->fd >= 0)
+        fd = openat(parent->fd, dir.path.c_str() + parent->path.size() + 1, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    else
+        fd = ::open(dir.path.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    struct stat st;
+    bool first = fd >= 0 && fstat(fd, &st) == 0;
+    {
+        lock_guard<mutex> guard(lock);
+        if(parent && parent->fd >= 0 && --parent->pending == 0) {	// the last subdirectory of parent is open
+            ::close(parent->fd);
+            parent->fd = -1;
+            --open;
+        }
+        first = first && visited.insert(make_pair(st.st_dev, st.st_ino)).second;
+    }
+    vector<DirectoryEntry> entries;
+    if(fd < 0 || (first && !listDirectory(fd, entries))) {
+        cerr << "Cannot open directory " << dir.path << endl;
+        if(fd >= 0)
+            ::close(fd);
+        return;
+    }
+    if(!first) {	// already listed on another path, e.g. a symlink to a parent
+        ::close(fd);
+        return;
+    }
+    sort(entries.begin(), entries.end());
+
+    for(size_t i=0; i<entries.size(); ++i) {
+        const string& name = entries[i].name;
+        unsigned char type = entries[i].type;
+        if(type == DT_UNKNOWN || type == DT_LNK) {
+            struct stat st;
+            if(fstatat(fd, name.c_str(), &st, 0) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if(type == DT_DIR) {
+            Directory child = { dir.path + "/" + name, &dir, -1, 0, vector<pair<string, Directory*> >() };
+            lock_guard<mutex> guard(lock);
+            directories.push_back(child);
+            dir.entries.push_back(make_pair(string(), &directories.back()));
+            children.push_back(&directories.back());
+        } else if(type == DT_REG && isPilotFilename(name))
+            dir.entries.push_back(make_pair(dir.path + "/" + name, (Directory*) 0));
+    }
+
+    lock_guard<mutex> guard(lock);	// before the children are queued
+    if(children.empty() || open >= maxopen)
+        ::close(fd);
+    else {
+        dir.fd = fd;
+        dir.pending = children.size();
+        ++open;
+    }
+}
+
+void PilotTreeWalker::flatten(const Directory& dir, vector<string>& files) const
+{
+    for(size_t i=0; i<dir.entries.size(); ++i) {
+        if(dir.entries[i].second)
+            flatten(*dir.entries[i].second, files);
+        else
+            files.push_back(dir.entries[i].first);
+    }
+}
+
+/**
+ * Append path to files, or if it is a directory, all *.TFR files below it in sorted order.
+ * Entries are not stat'ed, files of the wrong size are noticed when they are read.
+ */
+void collectPilotFiles(const string& path, vector<string>& files)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        files.push_back(path);
+        return;
+    }
+    PilotTreeWalker walker;
+    walker.walk(path, files);
+}
+
+/**
+ * A read-only memory mapping of a whole file.
+ */
+class MappedFile {
+private:
+    void* address;
+    size_t length;
+    int fd;	// kept open for page cache advice
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    static const size_t HUGEPAGESIZE = 2 << 20;	// large folios in the page cache, see drop()
+
+    MappedFile() : address(0), length(0), fd(-1) {}
+
+    ~MappedFile()
+    {
+        if(address)
+            munmap(address, length);
+        if(fd >= 0)
+            ::close(fd);
+    }
+
+    bool open(const string& filename)
+    {
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        length = ok ? st.st_size : 0;
+        if(ok && length) {
+            address = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+            if(address == MAP_FAILED) {
+                address = 0;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    /**
+     * The file will be read once from start to end: double the readahead of the mapping and the file.
+     */
+    void sequential()
+    {
+        if(address)
+            madvise(address, length, MADV_SEQUENTIAL);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    /**
+     * Unmap the whole pages of [offset, offset+size) from this process and drop them from the page cache, they
+     * are read again from disk on the next access.
+     */
+    void drop(size_t offset, size_t size)
+    {
+        size_t pagesize = sysconf(_SC_PAGESIZE);
+        size_t first = (offset + pagesize - 1) / pagesize * pagesize;
+        size_t end = offset + size >= length ? length : (offset + size) / pagesize * pagesize;
+        if(!address || first >= end)
+            return;
+        madvise((BYTE*) address + first, end - first, MADV_DONTNEED);
+        posix_fadvise(fd, first, end - first, POSIX_FADV_DONTNEED);
+    }
+
+    const BYTE* data() const
+    {
+        return (const BYTE*) address;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+};
+
+/**
+ * 64 bit FNV-1a hash.
+ */
+uint64_t fnv1a(const BYTE* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i=0; i<size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * CRC-32C (Castagnoli) lookup table for crc32c() on CPUs without the SSE 4.2 crc32 instruction.
+ */
+struct Crc32cTable {
+    uint32_t table[8][256];
+
+    Crc32cTable()
+    {
+        for(uint32_t i=0; i<256; ++i) {
+            uint32_t crc = i;
+            for(int bit=0; bit<8; ++bit)
+                crc = crc >> 1 ^ (crc & 1 ? 0x82F63B78 : 0);
+            table[0][i] = crc;
+        }
+        for(int t=1; t<8; ++t)	// slicing by 8
+            for(int i=0; i<256; ++i)
+                table[t][i] = table[t-1][i] >> 8 ^ table[0][table[t-1][i] & 0xFF];
+    }
+};
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+/**
+ * crc32c() with the crc32 instruction of SSE 4.2, 8 BYTEs per instruction.
+ */
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const BYTE* data, size_t size)
+{
+    uint64_t crc = 0xFFFFFFFF;
+    for(; size >= 8; data += 8, size -= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, data, sizeof(chunk));
+        crc = __builtin_ia32_crc32di(crc, chunk);
+    }
+    for(; size; ++data, --size)
+        crc = __builtin_ia32_crc32qi(crc, *data);
+    return ~crc;
+}
+#endif
+
+/**
+ * CRC-32C of size BYTEs, as used by iSCSI, ext4 and Btrfs. Uses the crc32 instruction where the CPU has it.
+ */
+uint32_t crc32c(const BYTE* data, size_t size)
+{
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if(hardware)
+        return crc32cHardware(data, size);
+#endif
+    static const Crc32cTable crc;
+    const uint32_t (&t)[8][256] = crc.table;
+    uint32_t c = 0xFFFFFFFF;
+    for(; size >= 8; data += 8, size -= 8) {
+        uint32_t low = c ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+        c = t[7][low & 0xFF] ^ t[6][low >> 8 & 0xFF] ^ t[5][low >> 16 & 0xFF] ^ t[4][low >> 24]
+            ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    for(; size; ++data, --size)
+        c = c >> 8 ^ t[0][(c ^ *data) & 0xFF];
+    return ~c;
+}
+
+/**
+ * SipHash-2-4 of size BYTEs with a 128 bit key, a keyed hash (MAC) which cannot be computed or forged without the key.
+ */
+uint64_t siphash(const BYTE key[16], const BYTE* data, size_t size)
+{
+    struct Bytes {
+        static uint64_t le(const BYTE* p, size_t n)	// n BYTEs little endian
+        {
+            uint64_t v = 0;
+            for(size_t i=n; i-- > 0; )
+                v = v << 8 | p[i];
+            return v;
+        }
+        static uint64_t rotl(uint64_t v, int b)
+        {
+            return v << b | v >> (64 - b);
+        }
+    };
+    uint64_t k0 = Bytes::le(key, 8), k1 = Bytes::le(key + 8, 8);
+    uint64_t v[4] = { k0 ^ 0x736f6d6570736575ULL, k1 ^ 0x646f72616e646f6dULL, k0 ^ 0x6c7967656e657261ULL,
+                      k1 ^ 0x7465646279746573ULL
+                    };
+    auto rounds = [&v](int n) {
+        for(int i=0; i<n; ++i) {
+            v[0] += v[1];
+            v[1] = Bytes::rotl(v[1], 13) ^ v[0];
+            v[0] = Bytes::rotl(v[0], 32);
+            v[2] += v[3];
+            v[3] = Bytes::rotl(v[3], 16) ^ v[2];
+            v[0] += v[3];
+            v[3] = Bytes::rotl(v[3], 21) ^ v[0];
+            v[2] += v[1];
+            v[1] = Bytes::rotl(v[1], 17) ^ v[2];
+            v[2] = Bytes::rotl(v[2], 32);
+        }
+    };
+    size_t full = size & ~(size_t) 7;
+    for(size_t i=0; i<full; i+=8) {
+        uint64_t m = Bytes::le(data + i, 8);
+        v[3] ^= m;
+        rounds(2);
+        v[0] ^= m;
+    }
+    uint64_t last = (uint64_t) size << 56 | Bytes::le(data + full, size - full);
+    v[3] ^= last;
+    rounds(2);
+    v[0] ^= last;
+    v[2] ^= 0xFF;
+    rounds(4);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/**
+ * Pilot archive (*.tfa) written by tfrdump pack. All numbers are in host byte order.
+ * The header is followed by the records of PILOTFILESIZE BYTEs each without gaps, starting at the first page boundary
+ * after the header. The index (one ArchiveEntry per record) and the string table with all paths follow the records.
+ */
+struct ArchiveHeader {
+    char magic[8];	// ARCHIVEMAGIC
+    uint32_t version;
+    uint32_t recordsize;	// PILOTFILESIZE
+    uint64_t count;	// number of records
+    uint64_t records;	// file offset of the first record, page aligned
+    uint64_t index;	// file offset of count ArchiveEntry
+    uint64_t names;	// file offset of the string table
+    uint64_t namessize;
+};
+
+struct ArchiveEntry {
+    int64_t mtime;	// modification time of the packed file, seconds since the epoch
+    uint64_t hash;	// fnv1a() of the record
+    uint64_t name;	// offset of the path in the string table
+    uint32_t namelength;
+    uint32_t size;	// BYTEs of the packed file up to PILOTFILESIZE for Layout::detect(), 0 in older archives
+};
+
+const char ARCHIVEMAGIC[8] = {'T', 'F', 'R', 'P', 'A', 'C', 'K', '1'};
+const size_t ARCHIVEALIGN = 4096;
+
+/**
+ * Check the magic number of an archive.
+ */
+bool isArchive(const string& path)
+{
+    char magic[sizeof(ARCHIVEMAGIC)];
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    bool archive = ::read(fd, magic, sizeof(magic)) == (ssize_t) sizeof(magic)
+                   && memcmp(magic, ARCHIVEMAGIC, sizeof(magic)) == 0;
+    if(nocachepollution)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+    return archive;
+}
+
+/**
+ * Iterates over pilot records. name and record stay valid until the next call of next(), format() is the format
+ * of the record (see Layout::detect()).
+ * Unreadable records are reported on stderr, skipped and remembered in failed().
+ */
+class RecordSource {
+protected:
+    bool failure;
+    const Layout* layout;
+
+public:
+    RecordSource() : failure(false), layout(&Layout::builtin()) {}
+    virtual ~RecordSource() {}
+    virtual bool next(string& name, const BYTE*& record) = 0;
+
+    bool failed() const
+    {
+        return failure;
+    }
+
+    const Layout& format() const
+    {
+        return *layout;
+    }
+};
+
+/**
+ * Pilot files, directories are expanded to all *.TFR files below them.
+ */
+class FileSource : public RecordSource {
+private:
+    vector<string> files;
+    size_t position;
+    PilotBuffer buffer;
+
+public:
+    explicit FileSource(const string& path) : position(0)
+    {
+        collectPilotFiles(path, files);
+    }
+
+    bool next(string& name, const BYTE*& record)
+    {
+        while(position < files.size()) {
+            const string& file = files[position++];
+            size_t size;
+            if(readPilotFile(file, buffer, size)) {
+                name = file;
+                record = buffer.data();
+                layout = &Layout::detect(name, record, size);
+                return true;
+            }
+            cerr << "Cannot read pilot file " << file << endl;
+            failure = true;
+        }
+        return false;
+    }
+};
+
+/**
+ * The records of a mapped archive, read without copying.
+ */
+class ArchiveSource : public RecordSource {
+private:
+    static const size_t DROPRECORDS = 1024;	// --no-cache-pollution: drop read records in chunks of about 4 MiB
+
+    MappedFile file;
+    const ArchiveHeader* header;
+    const ArchiveEntry* entries;
+    const char* names;
+    size_t position;
+    size_t end;
+    size_t dropped;	// records before this one are no longer cached
+    size_t dropfrom;	// file offset to drop from next, a 2 MiB boundary to catch large folios across chunks
+
+public:
+    ArchiveSource() : header(0), entries(0), names(0), position(0), end(0), dropped(0), dropfrom(0) {}
+
+    bool open(const string& path)
+    {
+        if(!file.open(path) || file.size() < sizeof(ArchiveHeader))
+            return false;
+        header = (const ArchiveHeader*) file.data();
+        uint64_t size = file.size();	// all sections must lie within the file, written so that nothing overflows
+        if(memcmp(header->magic, ARCHIVEMAGIC, sizeof(ARCHIVEMAGIC)) || header->version != 1
+                || header->recordsize != PILOTFILESIZE
+                || header->records > size || header->count > (size - header->records) / PILOTFILESIZE
+                || header->index > size || header->count > (size - header->index) / sizeof(ArchiveEntry)
+                || header->index % alignof(ArchiveEntry) != 0
+                || header->names > size || header->namessize > size - header->names)
+            return false;
+        entries = (const ArchiveEntry*) (file.data() + header->index);
+        names = (const char*) file.data() + header->names;
+        file.sequential();
+        end = header->count;
+        dropfrom = header->records;
+        return true;
+    }
+
+    /**
+     * Number of records in the archive.
+     */
+    size_t size() const
+    {
+        return header->count;
+    }
+
+    /**
+     * Only read the records [first, first+count).
+     */
+    void range(size_t first, size_t count)
+    {
+        position = dropped = min(first, (size_t) header->count);
+        end = min(position + count, (size_t) header->count);
+        dropfrom = header->records + position * PILOTFILESIZE;
+    }
+
+    /**
+     * File offsets of the record next() returned last and of its hash in the index, for tfrdump patch. Returns the
+     * stored hash.
+     */
+    uint64_t locate(uint64_t& record, uint64_t& hash) const
+    {
+        record = header->records + (position - 1) * PILOTFILESIZE;
+        hash = header->index + (position - 1) * sizeof(ArchiveEntry) + offsetof(ArchiveEntry, hash);
+        return entries[position - 1].hash;
+    }
+
+    bool next(string& name, const BYTE*& record)
+    {
+        for(;;) {
+            if(nocachepollution && position - dropped >= DROPRECORDS) {
+                size_t end = header->records + position * PILOTFILESIZE;
+                file.drop(dropfrom, end - dropfrom);
+                dropped = position;
+                dropfrom = max((size_t) header->records, end / MappedFile::HUGEPAGESIZE * MappedFile::HUGEPAGESIZE);
+            }
+            if(position >= end) {
+                if(nocachepollution && end == header->count)
+                    file.drop(0, file.size());
+                else if(nocachepollution)	// a range(), other readers may still need the rest
+                    file.drop(dropfrom, header->records + end * PILOTFILESIZE - dropfrom);
+                return false;
+            }
+            const ArchiveEntry& entry = entries[position++];
+            if(entry.name > header->namessize || entry.namelength > header->namessize - entry.name
+                    || entry.size > PILOTFILESIZE) {
+                cerr << "Damaged index entry " << position - 1 << " in archive" << endl;
+                failure = true;
+                continue;
+            }
+            name.assign(names + entry.name, entry.namelength);
+            record = file.data() + header->records + (position - 1) * PILOTFILESIZE;
+            layout = &Layout::detect(name, record, entry.size);
+            return true;
+        }
+    }
+};
+
+/**
+ * Back to back records from stdin, e.g. <tt>cat *.TFR | tfrdump -</tt>. A reader thread reads into a ring of RINGSIZE
+ * chunks of up to CHUNKRECORDS records each and publishes a chunk as soon as a read() completed at least one record,
+ * so a slow pipe is decoded record by record while files are read in large blocks. The records are handed out in place
+ * and a chunk goes back to the reader as soon as its last record was consumed. Records are named stdin:0, stdin:1, ...
+ * The reader waits in poll() together with a wakeup pipe, so a consumer which stops early does not wait for more input.
+ */
+class StreamSource : public RecordSource {
+private:
+    static const size_t CHUNKRECORDS = 256;
+    static const size_t RINGSIZE = 4;
+
+    struct Chunk {
+        size_t index;
+        size_t size;	// BYTEs filled, less than a full chunk only at the end of the stream
+    };
+
+    int fd;
+    int wakeup[2];	// written by the destructor to stop the reader
+    vector<vector<BYTE> > ring;
+    BoundedQueue<size_t> empty;
+    BoundedQueue<Chunk> full;
+    thread reader;
+    Chunk current;
+    size_t position;	// within the current chunk
+    size_t count;
+    bool started;
+
+    /**
+     * Wait until fd can be read, false if the destructor asked to stop.
+     */
+    bool readable()
+    {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wakeup[0], POLLIN, 0 } };
+        while(poll(fds, 2, -1) < 0)
+            if(errno != EINTR)
+                return true;	// let read() report it
+        return !fds[1].revents;
+    }
+
+    void run()
+    {
+        size_t index;
+        off_t offset = lseek(fd, 0, SEEK_CUR);	// -1 for pipes, which have no page cache to drop
+        off_t dropped = offset;
+        PilotBuffer partial;	// the incomplete record at the end of the last chunk
+        size_t carried = 0;
+        while(empty.pop(index)) {
+            BYTE* data = &ring[index][0];
+            copy(partial.begin(), partial.begin() + carried, data);
+            size_t filled = carried, read = 0;
+            bool eof = false;
+            while(filled < PILOTFILESIZE) {
+                if(!readable()) {
+                    full.close();
+                    return;
+                }
+                ssize_t n = ::read(fd, data + filled, ring[index].size() - filled);
+                if(n < 0 && errno == EINTR)
+                    continue;
+                if(n <= 0) {
+                    if(n < 0)
+                        cerr << "Error reading stdin: " << strerror(errno) << endl;
+                    eof = true;
+                    break;
+                }
+                filled += n;
+                read += n;
+            }
+            if(nocachepollution && offset >= 0) {
+                // again from a 2 MiB boundary for the large folios across chunk boundaries, at the end up to EOF
+                offset += read;
+                posix_fadvise(fd, dropped, eof ? 0 : offset - dropped, POSIX_FADV_DONTNEED);
+                dropped = max(dropped, offset / (off_t) MappedFile::HUGEPAGESIZE * (off_t) MappedFile::HUGEPAGESIZE);
+            }
+            size_t complete = eof ? filled : filled / PILOTFILESIZE * PILOTFILESIZE;	// at the end the rest as well
+            carried = filled - complete;
+            copy(data + complete, data + filled, partial.begin());
+            Chunk chunk = { index, complete };
+            full.push(chunk);
+            if(eof)
+                break;
+        }
+        full.close();
+    }
+
+public:
+    explicit StreamSource(int fd)
+        : fd(fd), ring(RINGSIZE, vector<BYTE>(CHUNKRECORDS * PILOTFILESIZE)), empty(RINGSIZE), full(RINGSIZE),
+          position(0), count(0), started(false)
+    {
+        current.size = 0;
+        for(size_t i=0; i<RINGSIZE; ++i)
+            empty.push(i);
+        if(pipe(wakeup) != 0)
+            wakeup[0] = wakeup[1] = -1;	// poll() ignores it, the reader then stops at the end of the input
+        reader = thread(&StreamSource::run, this);
+    }
+
+    ~StreamSource()
+    {
+        empty.close();
+        if(wakeup[1] >= 0 && ::write(wakeup[1], "", 1) < 0)
+            cerr << "Cannot stop reading stdin: " << strerror(errno) << endl;
+        reader.join();
+        if(wakeup[0] >= 0) {
+            ::close(wakeup[0]);
+            ::close(wakeup[1]);
+        }
+    }
+
+    bool next(string& name, const BYTE*& record)
+    {
+        if(!started || position + PILOTFILESIZE > current.size) {
+            if(started) {
+                if(position < current.size) {
+                    cerr << "Incomplete record of " << current.size - position << " BYTEs at the end of stdin" << endl;
+                    failure = true;
+                }
+                empty.push(current.index);
+            }
+            started = true;
+            position = 0;
+            if(!full.pop(current) || current.size < PILOTFILESIZE) {
+                if(current.size && current.size < PILOTFILESIZE) {
+                    cerr << "Incomplete record of " << current.size << " BYTEs at the end of stdin" << endl;
+                    failure = true;
+                }
+                current.size = 0;
+                return false;
+            }
+        }
+        ostringstream label;
+        label << "stdin:" << count++;
+        name = label.str();
+        record = &ring[current.index][position];
+        layout = &Layout::detect(name, record, PILOTFILESIZE);
+        position += PILOTFILESIZE;
+        return true;
+    }
+};
+
+/**
+ * Open stdin ("-"), an archive, a pilot file or a directory. Returns a null pointer for damaged archives.
+ */
+unique_ptr<RecordSource> openSource(const string& path)
+{
+    if(path == "-")
+        return unique_ptr<RecordSource>(new StreamSource(STDIN_FILENO));
+    if(!isArchive(path))
+        return unique_ptr<RecordSource>(new FileSource(path));
+    unique_ptr<ArchiveSource> archive(new ArchiveSource);
+    if(!archive->open(path)) {
+        cerr << "Damaged archive " << path << endl;
+        return unique_ptr<RecordSource>();
+    }
+    return unique_ptr<RecordSource>(archive.release());
+}
+
+/**
+ * Pad out with zeroes to a multiple of alignment.
+ */
+void padTo(ostream& out, size_t alignment)
+{
+    static const char zeroes[ARCHIVEALIGN] = {0};
+    size_t position = out.tellp();
+    if(position % alignment)
+        out.write(zeroes, alignment - position % alignment);
+}
+
+/**
+ * tfrdump pack [--layout file]... <TFR-File|directory>... -o archive.tfa
+ *
+ * Writes all pilot files (with --layout also those of other formats) into one archive (see ArchiveHeader). The archive is written to archive.tfa.tmp first and
+ * renamed when it is complete.
+ */
+int packArchive(int argc, char* argv[])
+{
+    string output;
+    vector<string> files;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "-o" && i+1 < argc)
+            output = argv[++i];
+        else if(arg == "--layout" && i+1 < argc) {
+            if(!addLayoutFile(argv[++i]))
+                return -1;
+        } else
+            collectPilotFiles(arg, files);
+    }
+    if(output.empty() || files.empty()) {
+        cerr << "Usage: tfrdump pack [--layout file]... <TFR-File|directory>... -o archive.tfa" << endl;
+        return -1;
+    }
+
+    string temporary = output + ".tmp";
+    ofstream archive(temporary.c_str(), ios::out|ios::binary|ios::trunc);
+    if(!archive.is_open()) {
+        cerr << "Cannot open output file " << temporary << endl;
+        return -1;
+    }
+    ArchiveHeader header = ArchiveHeader();
+    memcpy(header.magic, ARCHIVEMAGIC, sizeof(ARCHIVEMAGIC));
+    header.version = 1;
+    header.recordsize = PILOTFILESIZE;
+    archive.write((const char*) &header, sizeof(header));
+    padTo(archive, ARCHIVEALIGN);
+    header.records = archive.tellp();
+
+    int status = 0;
+    vector<ArchiveEntry> entries;
+    string names;
+    PilotBuffer buffer;
+    for(size_t i=0; i<files.size(); ++i) {
+        struct stat st;
+        size_t size;
+        if(!readPilotFile(files[i], buffer, size) || stat(files[i].c_str(), &st) != 0) {
+            cerr << "Cannot read pilot file " << files[i] << endl;
+            status = 1;
+            continue;
+        }
+        archive.write((const char*) buffer.data(), buffer.size());
+        ArchiveEntry entry = ArchiveEntry();
+        entry.mtime = st.st_mtime;
+        entry.hash = fnv1a(buffer.data(), buffer.size());
+        entry.name = names.size();
+        entry.namelength = files[i].size();
+        entry.size = size;
+        entries.push_back(entry);
+        names += files[i];
+    }
+    header.count = entries.size();
+
+    padTo(archive, sizeof(uint64_t));
+    header.index = archive.tellp();
+    if(!entries.empty())
+        archive.write((const char*) &entries[0], entries.size() * sizeof(ArchiveEntry));
+    header.names = archive.tellp();
+    header.namessize = names.size();
+    archive.write(names.data(), names.size());
+    archive.seekp(0);
+    archive.write((const char*) &header, sizeof(header));
+    archive.close();
+    if(archive.fail() || rename(temporary.c_str(), output.c_str()) != 0) {
+        cerr << "Error writing " << output << endl;
+        remove(temporary.c_str());
+        return -1;
+    }
+    return status;
+}
+
+/**
+ * One mapped column of a column export, see ColumnWriter.
+ */
+struct QueryColumn {
+    string name;
+    BYTE width;
+    MappedFile data;
+    MappedFile zone;
+
+    DWORD value(size_t row) const
+    {
+        switch(width) {
+        case 1:
+            return data.data()[row];
+        case 2:
+            return ((const WORD*) data.data())[row];
+        default:
+            return ((const DWORD*) data.data())[row];
+        }
+    }
+
+    const DWORD* zones() const
+    {
+        return (const DWORD*) zone.data();
+    }
+};
+
+enum QueryOp { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+/**
+ * A comparison "column op value" from --where.
+ */
+struct Predicate {
+    QueryColumn* column;
+    QueryOp op;
+    DWORD value;
+};
+
+/**
+ * Split "points>=1000" into column, operator and value. The value must be a DWORD, negative or larger values fail
+ * instead of wrapping around.
+ */
+bool parsePredicate(const string& text, string& column, QueryOp& op, DWORD& value)
+{
+    size_t pos = text.find_first_of("<>=!");
+    if(pos == string::npos || pos == 0)
+        return false;
+    column = text.substr(0, pos);
+    string ops = text.substr(pos, text.find_first_not_of("<>=!", pos) - pos);
+    if(ops == "==" || ops == "=")
+        op = OP_EQ;
+    else if(ops == "!=")
+        op = OP_NE;
+    else if(ops == "<")
+        op = OP_LT;
+    else if(ops == "<=")
+        op = OP_LE;
+    else if(ops == ">")
+        op = OP_GT;
+    else if(ops == ">=")
+        op = OP_GE;
+    else
+        return false;
+    string number = text.substr(pos + ops.size());
+    char* end = 0;
+    errno = 0;
+    unsigned long long parsed = strtoull(number.c_str(), &end, 0);
+    value = parsed;
+    return !number.empty() && *end == 0 && number.find('-') == string::npos && errno == 0 && parsed <= 0xFFFFFFFF;
+}
+
+/**
+ * Zone map test: can a block with values in [min, max] contain a match?
+ */
+bool zoneMayMatch(QueryOp op, DWORD min, DWORD max, DWORD v)
+{
+    switch(op) {
+    case OP_EQ:
+        return min <= v && v <= max;
+    case OP_NE:
+        return !(min == v && max == v);
+    case OP_LT:
+        return min < v;
+    case OP_LE:
+        return min <= v;
+    case OP_GT:
+        return max > v;
+    default:
+        return max >= v;
+    }
+}
+
+/**
+ * Zone map test: does every value in [min, max] match?
+ */
+bool zoneAllMatch(QueryOp op, DWORD min, DWORD max, DWORD v)
+{
+    switch(op) {
+    case OP_EQ:
+        return min == v && max == v;
+    case OP_NE:
+        return v < min || v > max;
+    case OP_LT:
+        return max < v;
+    case OP_LE:
+        return max <= v;
+    case OP_GT:
+        return min > v;
+    default:
+        return min >= v;
+    }
+}
+
+/**
+ * Clear mask[i] for every value that fails the comparison. The loops are branch free, so the compiler vectorises them.
+ */
+template<typename T>
+TFRDUMP_KERNEL void filterBlock(const T* values, size_t n, QueryOp op, DWORD v, BYTE* mask)
+{
+    switch(op) {
+    case OP_EQ:
+        for(size_t i=0; i<n; ++i)
+            mask[i] &= values[i] == v;
+        break;
+    case OP_NE:
+        for(size_t i=0; i<n; ++i)
+            mask[i] &= values[i] != v;
+        break;
+    case OP_LT:
+        for(size_t i=0; i<n; ++i)
+            mask[i] &= values[i] < v;
+        break;
+    case OP_LE:
+        for(size_t i=0; i<n; ++i)
+            mask[i] &= values[i] <= v;
+        break;
+    case OP_GT:
+        for(size_t i=0; i<n; ++i)
+            mask[i] &= values[i] > v;
+        break;
+    default:
+        for(size_t i=0; i<n; ++i)
+            mask[i] &= values[i] >= v;
+    }
+}
+
+/**
+ * filterBlock() for the three column widths, compiled per instruction set.
+ */
+TFRDUMP_MULTIVERSION
+void filterColumn(const BYTE* values, size_t n, QueryOp op, DWORD v, BYTE* mask)
+{
+    filterBlock(values, n, op, v, mask);
+}
+
+TFRDUMP_MULTIVERSION
+void filterColumn(const WORD* values, size_t n, QueryOp op, DWORD v, BYTE* mask)
+{
+    filterBlock(values, n, op, v, mask);
+}
+
+TFRDUMP_MULTIVERSION
+void filterColumn(const DWORD* values, size_t n, QueryOp op, DWORD v, BYTE* mask)
+{
+    filterBlock(values, n, op, v, mask);
+}
+
+/**
+ * tfrdump query --columns DIR [--where column<op>value]... [--select column,...] [--count]
+ *
+ * Reads a column export (see ColumnWriter), only the column files used by --where and --select are mapped.
+ * Blocks of ColumnWriter::BLOCKROWS rows are skipped by their zone maps, the remaining ones are filtered column by
+ * column into a row mask, and only the matching rows are printed as CSV.
+ */
+int queryColumns(int argc, char* argv[])
+{
+    string dir;
+    vector<string> where;
+    vector<string> select;
+    bool countonly = false;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--columns" && i+1 < argc)
+            dir = argv[++i];
+        else if(arg == "--where" && i+1 < argc)
+            where.push_back(argv[++i]);
+        else if(arg == "--select" && i+1 < argc) {
+            istringstream list(argv[++i]);
+            string name;
+            while(getline(list, name, ','))
+                select.push_back(name);
+        } else if(arg == "--count")
+            countonly = true;
+        else {
+            cerr << "Unknown query option " << arg << endl;
+            return -1;
+        }
+    }
+    if(dir.empty()) {
+        cerr << "Please name a column export with --columns DIR" << endl;
+        return -1;
+    }
+
+    ifstream meta((dir + "/columns.meta").c_str());
+    string word;
+    int version = 0;
+    size_t rows = 0, blockrows = 0;
+    map<string, int> widths;
+    if(!(meta >> word >> version) || word != "tfrdump-columns" || version != 1) {
+        cerr << "No column export in " << dir << endl;
+        return -1;
+    }
+    while(meta >> word) {
+        if(word == "rows")
+            meta >> rows;
+        else if(word == "blockrows")
+            meta >> blockrows;
+        else if(word == "column") {
+            string name;
+            int width;
+            meta >> name >> width;
+            widths[name] = width;
+        }
+    }
+    if(blockrows != ColumnWriter::BLOCKROWS) {
+        cerr << "Unsupported block size in " << dir << endl;
+        return -1;
+    }
+
+    // map every referenced column once
+    map<string, unique_ptr<QueryColumn> > columns;
+    vector<string> referenced = select;
+    vector<Predicate> predicates(where.size());
+    vector<string> predicatecolumns(where.size());
+    for(size_t i=0; i<where.size(); ++i) {
+        if(!parsePredicate(where[i], predicatecolumns[i], predicates[i].op, predicates[i].value)) {
+            cerr << "Cannot parse condition " << where[i] << endl;
+            return -1;
+        }
+        if(!widths.count(predicatecolumns[i])) {	// also file, which is no numeric column
+            cerr << "Cannot filter on column " << predicatecolumns[i] << endl;
+            return -1;
+        }
+        referenced.push_back(predicatecolumns[i]);
+    }
+    if(select.empty()) {
+        select.push_back("file");
+        select.insert(select.end(), predicatecolumns.begin(), predicatecolumns.end());
+        select.erase(unique(select.begin(), select.end()), select.end());
+    }
+    for(size_t i=0; i<referenced.size(); ++i) {
+        const string& name = referenced[i];
+        if(name == "file" || columns.count(name))
+            continue;
+        if(!widths.count(name)) {
+            cerr << "Unknown column " << name << endl;
+            return -1;
+        }
+        unique_ptr<QueryColumn> column(new QueryColumn);
+        column->name = name;
+        column->width = widths[name];
+        if(!column->data.open(dir + "/" + name + ".col") || !column->zone.open(dir + "/" + name + ".zone")) {
+            cerr << "Cannot read column " << name << endl;
+            return -1;
+        }
+        size_t blocks = rows / blockrows + (rows % blockrows != 0);
+        if((column->width != 1 && column->width != 2 && column->width != 4)
+                || column->data.size() / column->width < rows
+                || column->zone.size() / (2 * sizeof(DWORD)) < blocks) {
+            cerr << "Column " << name << " in " << dir << " is shorter than its " << rows << " rows" << endl;
+            return -1;
+        }
+        columns[name] = move(column);
+    }
+    for(size_t i=0; i<predicates.size(); ++i)
+        predicates[i].column = columns[predicatecolumns[i]].get();
+
+    MappedFile names, nameindex;
+    bool withnames = !countonly && find(select.begin(), select.end(), "file") != select.end();
+    if(withnames && (!names.open(dir + "/file.dat") || !nameindex.open(dir + "/file.idx"))) {
+        cerr << "Cannot read filenames in " << dir << endl;
+        return -1;
+    }
+    const uint64_t* offsets = (const uint64_t*) nameindex.data();
+    if(withnames) {	// rows+1 ascending offsets into file.dat
+        bool valid = nameindex.size() / sizeof(uint64_t) > rows;
+        for(size_t row=0; valid && row<rows; ++row)
+            valid = offsets[row] <= offsets[row+1];
+        if(!valid || offsets[rows] > names.size()) {
+            cerr << "Filenames in " << dir << " do not match its " << rows << " rows" << endl;
+            return -1;
+        }
+    }
+
+    if(!countonly) {
+        for(size_t i=0; i<select.size(); ++i)
+            cout << (i ? "," : "") << select[i];
+        cout << "\n";
+    }
+
+    size_t matches = 0;
+    BYTE mask[ColumnWriter::BLOCKROWS];
+    for(size_t first=0; first<rows; first+=blockrows) {
+        size_t n = min(blockrows, rows - first);
+        size_t b = first / blockrows;
+        bool candidate = true;
+        memset(mask, 1, n);
+        for(size_t p=0; p<predicates.size() && candidate; ++p) {
+            const Predicate& pred = predicates[p];
+            DWORD zmin = pred.column->zones()[2*b], zmax = pred.column->zones()[2*b+1];
+            if(!zoneMayMatch(pred.op, zmin, zmax, pred.value))
+                candidate = false;
+            else if(zoneAllMatch(pred.op, zmin, zmax, pred.value))
+                continue;
+            else if(pred.column->width == 1)
+                filterColumn(pred.column->data.data() + first, n, pred.op, pred.value, mask);
+            else if(pred.column->width == 2)
+                filterColumn((const WORD*) pred.column->data.data() + first, n, pred.op, pred.value, mask);
+            else
+                filterColumn((const DWORD*) pred.column->data.data() + first, n, pred.op, pred.value, mask);
+        }
+        if(!candidate)
+            continue;
+        for(size_t i=0; i<n; ++i) {
+            if(!mask[i])
+                continue;
+            ++matches;
+            if(countonly)
+                continue;
+            size_t row = first + i;
+            for(size_t s=0; s<select.size(); ++s) {
+                cout << (s ? "," : "");
+                if(select[s] == "file")
+                    csvQuote(cout, (const char*) names.data() + offsets[row], offsets[row+1] - offsets[row]);
+                else
+                    cout << columns[select[s]]->value(row);
+            }
+            cout << "\n";
+        }
+    }
+    if(countonly)
+        cout << matches << endl;
+    return 0;
+}
+
+/**
+ * Find the field and element index of a column name like "points" or "kills_5" (see columnName()).
+ */
+bool parseColumnName(const string& name, int& field, int& index)
+{
+    for(int f=0; f<F_COUNT; ++f)
+        for(int i=0; i<pilotfields[f].count; ++i)
+            if(columnName(f, i) == name) {
+                field = f;
+                index = i;
+                return true;
+            }
+    return false;
+}
+
+template<typename T>
+void writeBinary(ostream& out, T value)
+{
+    out.write((const char*) &value, sizeof(value));
+}
+
+template<typename T>
+bool readBinary(istream& in, T& value)
+{
+    return (bool) in.read((char*) &value, sizeof(value));
+}
+
+void writeBinary(ostream& out, const string& value)
+{
+    writeBinary(out, (uint32_t) value.size());
+    out.write(value.data(), value.size());
+}
+
+bool readBinary(istream& in, string& value)
+{
+    uint32_t size;
+    if(!readBinary(in, size) || size > 1 << 20)
+        return false;
+    value.resize(size);
+    return size == 0 || in.read(&value[0], size);
+}
+
+/**
+ * Quantiles of DWORD values in log-linear buckets: values below 64 are counted exactly, larger ones in 64 buckets per
+ * power of two, so a reported quantile is off by less than 1 %. Sketches merge exactly by adding bucket counts, the
+ * merged sketch is the same as if all values had been added to one.
+ */
+class QuantileSketch {
+public:
+    static const size_t BUCKETS = 64 * 27;
+
+    QuantileSketch() : counts(BUCKETS, 0) {}
+
+    void add(DWORD v)
+    {
+        ++counts[bucket(v)];
+    }
+
+    void merge(const QuantileSketch& other)
+    {
+        for(size_t b=0; b<BUCKETS; ++b)
+            counts[b] += other.counts[b];
+    }
+
+    /**
+     * Value at quantile q (0 to 1) of total added values, the middle of its bucket.
+     */
+    DWORD quantile(double q, uint64_t total) const
+    {
+        uint64_t rank = total ? (uint64_t) (q * (total - 1)) : 0;
+        uint64_t seen = 0;
+        for(size_t b=0; b<BUCKETS; ++b) {
+            seen += counts[b];
+            if(seen > rank)
+                return middle(b);
+        }
+        return 0;
+    }
+
+    /**
+     * Only the used buckets as (index, count) pairs.
+     */
+    void write(ostream& out) const
+    {
+        writeBinary(out, (uint32_t) (BUCKETS - count(counts.begin(), counts.end(), 0)));
+        for(size_t b=0; b<BUCKETS; ++b)
+            if(counts[b]) {
+                writeBinary(out, (uint32_t) b);
+                writeBinary(out, counts[b]);
+            }
+    }
+
+    bool read(istream& in)
+    {
+        uint32_t used, b;
+        if(!readBinary(in, used) || used > BUCKETS)
+            return false;
+        for(uint32_t i=0; i<used; ++i)
+            if(!readBinary(in, b) || b >= BUCKETS || !readBinary(in, counts[b]))
+                return false;
+        return true;
+    }
+
+    /**
+     * Bucket of v. Above 63, v has e+1 = 32-clz(v) significant bits and the 6 after the leading one select one of the
+     * 64 buckets of exponent e.
+     */
+    static constexpr size_t bucket(DWORD v)
+    {
+        return v < 64 ? v : 64 * (26 - __builtin_clz(v)) + (v >> (25 - __builtin_clz(v))) - 64;
+    }
+
+private:
+    vector<uint64_t> counts;
+
+    static DWORD middle(size_t b)
+    {
+        if(b < 64)
+            return b;
+        int shift = b / 64 - 1;
+        return ((uint64_t) (b % 64 + 64) << shift) + ((uint64_t) 1 << shift) / 2;
+    }
+};
+
+static_assert(QuantileSketch::bucket(63) == 63 && QuantileSketch::bucket(64) == 64
+              && QuantileSketch::bucket(0x80000000) == 1664 && QuantileSketch::bucket(0xFFFFFFFF) == 1727
+              && QuantileSketch::BUCKETS == 1728, "the largest DWORDs must land in the last buckets");
+
+/**
+ * Count, sum, minimum, maximum and quantiles of one column.
+ */
+struct FieldSummary {
+    uint64_t count;
+    uint64_t sum;
+    DWORD min;
+    DWORD max;
+    QuantileSketch sketch;
+
+    FieldSummary() : count(0), sum(0), min(0xFFFFFFFF), max(0) {}
+
+    void add(DWORD v)
+    {
+        ++count;
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+        sketch.add(v);
+    }
+
+    /**
+     * Quantile from the sketch, within the exact minimum and maximum.
+     */
+    DWORD quantile(double q) const
+    {
+        return std::min(std::max(sketch.quantile(q, count), min), max);
+    }
+
+    void merge(const FieldSummary& other)
+    {
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        sketch.merge(other.sketch);
+    }
+};
+
+/**
+ * State of tfrdump summary: a FieldSummary of every --field for each value of the --group-by column, and the --top
+ * pilots by the first field. The partial states of disjoint inputs (--emit-partial) merge into exactly the state of the
+ * whole input, so every storage node can summarise its own part and only the partials are moved.
+ */
+class Summary {
+public:
+    Summary() : groupfield(-1), groupindex(0), top(0) {}
+
+    bool configure(const vector<string>& columns, const string& groupby, size_t top);
+    void add(const CompactPilot&, const string&);
+    bool merge(const Summary&);
+    void print(ostream&) const;
+    void write(ostream&) const;
+    bool write(const string&) const;
+    bool read(istream&);
+    bool read(const string&);
+
+private:
+    typedef pair<DWORD, string> Ranked;	// first field and file name of a --top pilot
+
+    vector<string> columns;
+    vector<pair<int, int> > fields;	// field and index of every column
+    string groupby;
+    int groupfield;	// -1: one group for everything
+    int groupindex;
+    size_t top;
+    map<DWORD, vector<FieldSummary> > groups;
+    vector<Ranked> best;	// heap, the worst of the top pilots in front
+
+    /**
+     * Higher value first, then file name, so the top pilots of a merge do not depend on the order of the partials.
+     */
+    static bool better(const Ranked& a, const Ranked& b)
+    {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    }
+
+    void rank(const Ranked&);
+};
+
+/**
+ * Set the columns to summarise, the grouping column ("" for none) and the number of top pilots.
+ */
+bool Summary::configure(const vector<string>& columns, const string& groupby, size_t top)
+{
+    this->columns = columns;
+    this->groupby = groupby;
+    this->top = top;
+    fields.resize(columns.size());
+    for(size_t c=0; c<columns.size(); ++c)
+        if(!parseColumnName(columns[c], fields[c].first, fields[c].second)) {
+            cerr << "Unknown column " << columns[c] << endl;
+            return false;
+        }
+    groupfield = -1;
+    if(!groupby.empty() && !parseColumnName(groupby, groupfield, groupindex)) {
+        cerr << "Unknown column " << groupby << endl;
+        return false;
+    }
+    return !columns.empty();
+}
+
+void Summary::add(const CompactPilot& pilot, const string& name)
+{
+    DWORD key = groupfield < 0 ? 0 : pilot.get(PilotFieldId(groupfield), groupindex);
+    vector<FieldSummary>& group = groups[key];
+    group.resize(fields.size());
+    for(size_t c=0; c<fields.size(); ++c)
+        group[c].add(pilot.get(PilotFieldId(fields[c].first), fields[c].second));
+    if(top)
+        rank(Ranked(pilot.get(PilotFieldId(fields[0].first), fields[0].second), name));
+}
+
+void Summary::rank(const Ranked& candidate)
+{
+    if(best.size() < top) {
+        best.push_back(candidate);
+        push_heap(best.begin(), best.end(), better);
+    } else if(better(candidate, best.front())) {
+        pop_heap(best.begin(), best.end(), better);
+        best.back() = candidate;
+        push_heap(best.begin(), best.end(), better);
+    }
+}
+
+/**
+ * Add the state of another (partial) summary with the same columns, grouping and top size.
+ */
+bool Summary::merge(const Summary& other)
+{
+    if(other.columns != columns || other.groupby != groupby || other.top != top)
+        return false;
+    for(map<DWORD, vector<FieldSummary> >::const_iterator g=other.groups.begin(); g!=other.groups.end(); ++g) {
+        vector<FieldSummary>& group = groups[g->first];
+        group.resize(fields.size());
+        for(size_t c=0; c<fields.size(); ++c)
+            group[c].merge(g->second[c]);
+    }
+    for(size_t i=0; i<other.best.size(); ++i)
+        rank(other.best[i]);
+    return true;
+}
+
+void Summary::print(ostream& out) const
+{
+    if(groupfield >= 0)
+        out << groupby << "\t";
+    out << "column\tcount\tsum\tmin\tmax\tmean\tp50\tp90\tp99" << endl;
+    for(map<DWORD, vector<FieldSummary> >::const_iterator g=groups.begin(); g!=groups.end(); ++g)
+        for(size_t c=0; c<fields.size(); ++c) {
+            const FieldSummary& s = g->second[c];
+            if(groupfield >= 0)
+                out << g->first << "\t";
+            out << columns[c] << "\t" << s.count << "\t" << s.sum << "\t" << s.min << "\t" << s.max << "\t"
+                << (double) s.sum / s.count << "\t" << s.quantile(0.5) << "\t" << s.quantile(0.9) << "\t"
+                << s.quantile(0.99) << endl;
+        }
+    if(!top)
+        return;
+    vector<Ranked> sorted = best;
+    sort(sorted.begin(), sorted.end(), better);
+    out << endl << "rank\t" << columns[0] << "\tfile" << endl;
+    for(size_t i=0; i<sorted.size(); ++i)
+        out << i+1 << "\t" << sorted[i].first << "\t" << sorted[i].second << endl;
+}
+
+const char PARTIALMAGIC[8] = {'T', 'F', 'R', 'P', 'A', 'R', 'T', '1'};
+
+/**
+ * Write the state as a partial for tfrdump merge, in the byte order of this machine like archives.
+ */
+void Summary::write(ostream& out) const
+{
+    out.write(PARTIALMAGIC, sizeof(PARTIALMAGIC));
+    writeBinary(out, (uint32_t) columns.size());
+    for(size_t c=0; c<columns.size(); ++c)
+        writeBinary(out, columns[c]);
+    writeBinary(out, groupby);
+    writeBinary(out, (uint64_t) top);
+    writeBinary(out, (uint64_t) groups.size());
+    for(map<DWORD, vector<FieldSummary> >::const_iterator g=groups.begin(); g!=groups.end(); ++g) {
+        writeBinary(out, g->first);
+        for(size_t c=0; c<fields.size(); ++c) {
+            const FieldSummary& s = g->second[c];
+            writeBinary(out, s.count);
+            writeBinary(out, s.sum);
+            writeBinary(out, s.min);
+            writeBinary(out, s.max);
+            s.sketch.write(out);
+        }
+    }
+    writeBinary(out, (uint64_t) best.size());
+    for(size_t i=0; i<best.size(); ++i) {
+        writeBinary(out, best[i].first);
+        writeBinary(out, best[i].second);
+    }
+}
+
+bool Summary::write(const string& path) const
+{
+    ofstream out(path.c_str(), ios::out|ios::binary|ios::trunc);
+    write(out);
+    out.close();
+    return !out.fail();
+}
+
+/**
+ * Load a partial written by write(), replacing the current state.
+ */
+bool Summary::read(istream& in)
+{
+    char magic[sizeof(PARTIALMAGIC)];
+    uint32_t count;
+    uint64_t top, groupcount, bestcount;
+    if(!in.read(magic, sizeof(magic)) || memcmp(magic, PARTIALMAGIC, sizeof(magic)) || !readBinary(in, count))
+        return false;
+    vector<string> columns;	// the counts come from the file, so nothing is allocated before it was read
+    for(uint32_t c=0; c<count; ++c) {
+        string column;
+        if(!readBinary(in, column))
+            return false;
+        columns.push_back(column);
+    }
+    string groupby;
+    if(!readBinary(in, groupby) || !readBinary(in, top) || !configure(columns, groupby, top)
+            || !readBinary(in, groupcount))
+        return false;
+    groups.clear();
+    for(uint64_t i=0; i<groupcount; ++i) {
+        DWORD key;
+        if(!readBinary(in, key))
+            return false;
+        vector<FieldSummary>& group = groups[key];
+        group.resize(fields.size());
+        for(size_t c=0; c<fields.size(); ++c) {
+            FieldSummary& s = group[c];
+            if(!readBinary(in, s.count) || !readBinary(in, s.sum) || !readBinary(in, s.min) || !readBinary(in, s.max)
+                    || !s.sketch.read(in))
+                return false;
+        }
+    }
+    if(!readBinary(in, bestcount) || bestcount > top)
+        return false;
+    best.clear();
+    for(uint64_t i=0; i<bestcount; ++i) {
+        Ranked ranked;
+        if(!readBinary(in, ranked.first) || !readBinary(in, ranked.second))
+            return false;
+        best.push_back(ranked);
+    }
+    make_heap(best.begin(), best.end(), better);
+    return true;
+}
+
+bool Summary::read(const string& path)
+{
+    ifstream in(path.c_str(), ios::in|ios::binary);
+    return read(in);
+}
+
+/**
+ * Command line options shared by summary and coordinator.
+ */
+struct SummaryOptions {
+    vector<string> columns;
+    string groupby;
+    size_t top;
+    string partial;	// --emit-partial
+    string layout;	// --layout
+
+    SummaryOptions() : top(0) {}
+
+    /**
+     * Take argv[i] (and its value) if it is a summary option.
+     */
+    bool parse(int argc, char* argv[], int& i)
+    {
+        string arg = argv[i];
+        if(arg == "--field" && i+1 < argc)
+            columns.push_back(argv[++i]);
+        else if(arg == "--group-by" && i+1 < argc)
+            groupby = argv[++i];
+        else if(arg == "--top" && i+1 < argc)
+            top = strtoul(argv[++i], 0, 10);
+        else if(arg == "--emit-partial" && i+1 < argc)
+            partial = argv[++i];
+        else if(arg == "--layout" && i+1 < argc)
+            layout = argv[++i];
+        else
+            return false;
+        return true;
+    }
+
+    bool configure(Summary& summary) const
+    {
+        if(!layout.empty() && !addLayoutFile(layout))
+            return false;
+        return summary.configure(columns.empty() ? vector<string>(1, "points") : columns, groupby, top);
+    }
+
+    /**
+     * Print the summary, or write it to the --emit-partial file.
+     */
+    bool report(const Summary& summary) const
+    {
+        if(partial.empty()) {
+            summary.print(cout);
+            return true;
+        }
+        if(summary.write(partial))
+            return true;
+        cerr << "Error writing " << partial << endl;
+        return false;
+    }
+};
+
+/**
+ * tfrdump summary [--field column]... [--group-by column] [--top N] [--emit-partial file] [--layout file] <inputs>...
+ *
+ * Count, sum, min, max, mean and quantiles of the given columns (default points), optionally per value of another
+ * column, and the N pilots with the highest first column. With --emit-partial the state is written to file instead,
+ * partials of different inputs are combined by tfrdump merge.
+ */
+int summarize(int argc, char* argv[])
+{
+    SummaryOptions options;
+    vector<string> inputs;
+    for(int i=1; i<argc; ++i)
+        if(!options.parse(argc, argv, i))
+            inputs.push_back(argv[i]);
+    if(inputs.empty()) {
+        cerr << "Usage: tfrdump summary [--field column]... [--group-by column] [--top N] [--emit-partial file] "
+             << "[--layout file] <TFR-File|directory|archive|->..." << endl;
+        return -1;
+    }
+    Summary summary;
+    if(!options.configure(summary))
+        return -1;
+
+    int status = 0;
+    for(size_t i=0; i<inputs.size(); ++i) {
+        unique_ptr<RecordSource> source = openSource(inputs[i]);
+        if(!source) {
+            status = 1;
+            continue;
+        }
+        string name;
+        const BYTE* record;
+        while(source->next(name, record))
+            summary.add(CompactPilot(record, source->format()), name);
+        if(source->failed())
+            status = 1;
+    }
+    return options.report(summary) ? status : 1;
+}
+
+/**
+ * tfrdump merge [--emit-partial file] <partials>...
+ *
+ * Combine partials of tfrdump summary --emit-partial and print the summary of all their inputs, or write the combined
+ * partial for another level of merging.
+ */
+int mergePartials(int argc, char* argv[])
+{
+    SummaryOptions options;
+    vector<string> inputs;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--emit-partial" && i+1 < argc)
+            options.partial = argv[++i];
+        else
+            inputs.push_back(arg);
+    }
+    if(inputs.empty()) {
+        cerr << "Usage: tfrdump merge [--emit-partial file] <partials>..." << endl;
+        return -1;
+    }
+    Summary total;
+    for(size_t i=0; i<inputs.size(); ++i) {
+        Summary part;
+        if(!part.read(inputs[i])) {
+            cerr << "Cannot read partial " << inputs[i] << endl;
+            return 1;
+        }
+        if(i == 0)
+            total = part;
+        else if(!total.merge(part)) {
+            cerr << "Partial " << inputs[i] << " was made with other columns, grouping or top size" << endl;
+            return 1;
+        }
+    }
+    return options.report(total) ? 0 : 1;
+}
+
+/**
+ * Messages between coordinator and workers: type, flags and payload length, then the payload.
+ * CONFIG carries an empty Summary partial (columns, grouping, top size), CHUNK one work item per line ("F path" or
+ * "A first count path" for a range of archive records), RESULT the partial Summary of a chunk, QUIT ends the worker.
+ * A RESULT with MSG_FAILED covers only the pilots the worker could read.
+ */
+enum MessageType { MSG_CONFIG = 1, MSG_CHUNK, MSG_RESULT, MSG_QUIT };
+enum MessageFlags { MSG_FAILED = 1 };
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t size;
+};
+
+bool sendMessage(int fd, MessageType type, const string& payload, uint32_t flags = 0)
+{
+    MessageHeader header = { (uint32_t) type, flags, payload.size() };
+    string message((const char*) &header, sizeof(header));
+    message += payload;
+    for(size_t sent=0; sent<message.size(); ) {
+        ssize_t n = send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool receiveAll(int fd, char* data, size_t size)
+{
+    for(size_t received=0; received<size; ) {
+        ssize_t n = recv(fd, data + received, size - received, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        received += n;
+    }
+    return true;
+}
+
+bool receiveMessage(int fd, MessageType& type, string& payload, uint32_t& flags)
+{
+    MessageHeader header;
+    if(!receiveAll(fd, (char*) &header, sizeof(header)) || header.size > 1 << 30)
+        return false;
+    type = MessageType(header.type);
+    flags = header.flags;
+    payload.resize(header.size);
+    return header.size == 0 || receiveAll(fd, &payload[0], header.size);
+}
+
+/**
+ * Listening or connected stream socket for "unix:/path" or "host:port" (an empty host listens on all interfaces).
+ * Returns -1 and reports on failure.
+ */
+int openSocket(const string& address, bool listening)
+{
+    int fd = -1;
+    if(address.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        string path = address.substr(5);
+        if(path.size() >= sizeof(addr.sun_path)) {
+            cerr << "Socket path too long: " << path << endl;
+            return -1;
+        }
+        strcpy(addr.sun_path, path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+        if(listening)
+            unlink(path.c_str());
+        if(fd >= 0 && (listening ? bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0
+                       : connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)) {
+            ::close(fd);
+            fd = -1;
+        }
+    } else {
+        size_t colon = address.rfind(':');
+        if(colon == string::npos) {
+            cerr << "Use unix:/path or host:port, not " << address << endl;
+            return -1;
+        }
+        string host = address.substr(0, colon), port = address.substr(colon + 1);
+        struct addrinfo hints, *found;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        if(getaddrinfo(host.empty() ? 0 : host.c_str(), port.c_str(), &hints, &found) != 0) {
+            cerr << "Unknown address " << address << endl;
+            return -1;
+        }
+        for(struct addrinfo* a=found; a && fd < 0; a=a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype|SOCK_CLOEXEC, a->ai_protocol);
+            int yes = 1;
+            if(fd >= 0 && listening)
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            if(fd >= 0 && (listening ? bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, 64) != 0
+                           : connect(fd, a->ai_addr, a->ai_addrlen) != 0)) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+    }
+    if(fd < 0 && listening)
+        cerr << "Cannot listen on " << address << ": " << strerror(errno) << endl;
+    return fd;
+}
+
+/**
+ * Work queue of the coordinator, shared by one thread per worker connection. Chunks are handed out in order; once
+ * none are left, idle workers get a second copy of a chunk which is still running elsewhere, the first result counts.
+ * So a slow or stuck node delays the scan only until a faster one has redone its chunk. Chunks of lost workers are
+ * queued again.
+ */
+class Coordinator {
+public:
+    static const size_t MAXRUNNERS = 2;	// copies of one chunk running at the same time
+
+    Coordinator(const Summary& total, const vector<string>& chunks) : total(total), remaining(chunks.size())
+    {
+        ostringstream out;
+        total.write(out);
+        config = out.str();
+        for(size_t i=0; i<chunks.size(); ++i) {
+            Chunk chunk = { chunks[i], false, false, 0 };
+            this->chunks.push_back(chunk);
+            pending.push_back(i);
+        }
+    }
+
+    bool finished()
+    {
+        lock_guard<mutex> guard(lock);
+        return remaining == 0;
+    }
+
+    const Summary& result() const
+    {
+        return total;
+    }
+
+    /**
+     * Number of chunks whose result misses pilots the worker could not read.
+     */
+    size_t failures()
+    {
+        lock_guard<mutex> guard(lock);
+        size_t failed = 0;
+        for(size_t i=0; i<chunks.size(); ++i)
+            failed += chunks[i].failed;
+        return failed;
+    }
+
+    void serve(int fd);
+
+private:
+    struct Chunk {
+        string items;
+        bool done;
+        bool failed;	// the merged result lacks pilots which could not be read
+        size_t runners;
+    };
+
+    Summary total;
+    string config;
+    vector<Chunk> chunks;
+    deque<size_t> pending;
+    size_t remaining;
+    mutex lock;
+    condition_variable changed;
+
+    bool take(size_t&);
+    bool finish(size_t, const Summary*, bool);
+};
+
+/**
+ * Next chunk for a worker: a pending one, else a copy of the running chunk with the fewest runners. Blocks while all
+ * running chunks have MAXRUNNERS, false when everything is done.
+ */
+bool Coordinator::take(size_t& id)
+{
+    unique_lock<mutex> guard(lock);
+    for(;;) {
+        while(!pending.empty() && chunks[pending.front()].done)
+            pending.pop_front();
+        if(remaining == 0)
+            return false;
+        if(!pending.empty()) {
+            id = pending.front();
+            pending.pop_front();
+            ++chunks[id].runners;
+            return true;
+        }
+        size_t best = chunks.size();
+        for(size_t i=0; i<chunks.size(); ++i)
+            if(!chunks[i].done && chunks[i].runners < MAXRUNNERS
+                    && (best == chunks.size() || chunks[i].runners < chunks[best].runners))
+                best = i;
+        if(best < chunks.size()) {
+            id = best;
+            ++chunks[id].runners;
+            return true;
+        }
+        changed.wait(guard);
+    }
+}
+
+/**
+ * A run of chunk id ended with its partial, or with a null pointer if the worker was lost. failed if the worker could
+ * not read all pilots of the chunk. False if there was no usable partial.
+ */
+bool Coordinator::finish(size_t id, const Summary* part, bool failed)
+{
+    lock_guard<mutex> guard(lock);
+    Chunk& chunk = chunks[id];
+    --chunk.runners;
+    bool ok = part && (chunk.done || total.merge(*part));	// merge() refuses partials of another configuration
+    if(ok && !chunk.done) {
+        chunk.done = true;
+        chunk.failed = failed;
+        --remaining;
+    } else if(!ok && !chunk.done && chunk.runners == 0)
+        pending.push_front(id);
+    changed.notify_all();
+    return ok;
+}
+
+/**
+ * Feed one worker connection until all chunks are done.
+ */
+void Coordinator::serve(int fd)
+{
+    if(!sendMessage(fd, MSG_CONFIG, config))
+        return;
+    size_t id;
+    while(take(id)) {
+        MessageType type;
+        string payload;
+        uint32_t flags;
+        Summary part;
+        bool ok = sendMessage(fd, MSG_CHUNK, chunks[id].items) && receiveMessage(fd, type, payload, flags)
+                  && type == MSG_RESULT;
+        if(ok) {
+            istringstream in(payload);
+            ok = part.read(in);
+        }
+        if(!finish(id, ok ? &part : 0, ok && (flags & MSG_FAILED))) {
+            if(!finished())
+                cerr << "Lost a worker, its chunk is queued again" << endl;
+            return;
+        }
+    }
+    sendMessage(fd, MSG_QUIT, "");
+}
+
+/**
+ * tfrdump coordinator --listen address [--chunk N] [summary options] <TFR-File|directory|archive>...
+ *
+ * Splits the pilot files and archive records of the inputs into chunks of N (default 1024), hands them to every
+ * tfrdump worker which connects to address and prints the merged summary (see summarize()) when all chunks are done.
+ * Workers read the inputs by the same paths, e.g. on shared storage or on the same machine.
+ */
+int runCoordinator(int argc, char* argv[])
+{
+    SummaryOptions options;
+    string address;
+    size_t chunksize = 1024;
+    vector<string> inputs;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--listen" && i+1 < argc)
+            address = argv[++i];
+        else if(arg == "--chunk" && i+1 < argc)
+            chunksize = max(strtoul(argv[++i], 0, 10), 1UL);
+        else if(!options.parse(argc, argv, i))
+            inputs.push_back(arg);
+    }
+    if(address.empty() || inputs.empty()) {
+        cerr << "Usage: tfrdump coordinator --listen unix:/path|host:port [--chunk N] [--field column]... "
+             << "[--group-by column] [--top N] [--emit-partial file] <TFR-File|directory|archive>..." << endl;
+        return -1;
+    }
+    Summary summary;
+    if(!options.configure(summary))
+        return -1;
+
+    vector<string> chunks;
+    int status = 0;
+    for(size_t i=0; i<inputs.size(); ++i) {
+        if(inputs[i] == "-") {
+            cerr << "stdin cannot be distributed to workers" << endl;
+            return -1;
+        }
+        if(isArchive(inputs[i])) {
+            ArchiveSource archive;
+            if(!archive.open(inputs[i])) {
+                cerr << "Damaged archive " << inputs[i] << endl;
+                status = 1;
+                continue;
+            }
+            for(size_t first=0; first<archive.size(); first+=chunksize) {
+                ostringstream chunk;
+                chunk << "A " << first << " " << chunksize << " " << inputs[i] << "\n";
+                chunks.push_back(chunk.str());
+            }
+            continue;
+        }
+        vector<string> files;
+        collectPilotFiles(inputs[i], files);
+        for(size_t first=0; first<files.size(); first+=chunksize) {
+            string chunk;
+            for(size_t f=first; f<min(first + chunksize, files.size()); ++f)
+                chunk += "F " + files[f] + "\n";
+            chunks.push_back(chunk);
+        }
+    }
+
+    int listener = openSocket(address, true);
+    if(listener < 0)
+        return 1;
+    cerr << "Waiting for workers on " << address << ", " << chunks.size() << " chunks" << endl;
+    Coordinator coordinator(summary, chunks);
+    vector<int> connections;
+    vector<thread> servers;
+    while(!coordinator.finished()) {
+        struct pollfd p = { listener, POLLIN, 0 };
+        if(poll(&p, 1, 100) <= 0)
+            continue;
+        int fd = accept4(listener, 0, 0, SOCK_CLOEXEC);
+        if(fd < 0)
+            continue;
+        connections.push_back(fd);
+        servers.push_back(thread(&Coordinator::serve, &coordinator, fd));
+    }
+    ::close(listener);
+    if(address.compare(0, 5, "unix:") == 0)
+        unlink(address.c_str() + 5);
+    for(size_t i=0; i<connections.size(); ++i)	// wakes servers still waiting for a superfluous copy of a chunk
+        shutdown(connections[i], SHUT_RDWR);
+    for(size_t i=0; i<servers.size(); ++i) {
+        servers[i].join();
+        ::close(connections[i]);
+    }
+    size_t failures = coordinator.failures();
+    if(failures) {
+        cerr << "Workers could not read all pilots of " << failures << " chunks" << endl;
+        status = 1;
+    }
+    return options.report(coordinator.result()) ? status : 1;
+}
+
+/**
+ * tfrdump worker --connect address
+ *
+ * Summarise the chunks a coordinator sends until it has no more. Waits up to ten seconds for the coordinator to come
+ * up, so workers can be started first.
+ */
+int runWorker(int argc, char* argv[])
+{
+    string address;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--connect" && i+1 < argc)
+            address = argv[++i];
+        else if(arg == "--layout" && i+1 < argc) {
+            if(!addLayoutFile(argv[++i]))
+                return -1;
+        } else {
+            cerr << "Unknown worker option " << arg << endl;
+            return -1;
+        }
+    }
+    if(address.empty()) {
+        cerr << "Usage: tfrdump worker --connect unix:/path|host:port [--layout file]" << endl;
+        return -1;
+    }
+    int fd = -1;
+    for(int attempt=0; attempt<100 && fd < 0; ++attempt) {
+        fd = openSocket(address, false);
+        if(fd < 0)
+            this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    if(fd < 0) {
+        cerr << "Cannot connect to " << address << endl;
+        return 1;
+    }
+
+    Summary config;
+    MessageType type;
+    string payload;
+    uint32_t flags;
+    PilotBuffer buffer;
+    int status = 0;
+    while(receiveMessage(fd, type, payload, flags) && type != MSG_QUIT) {
+        istringstream in(payload);
+        if(type == MSG_CONFIG) {
+            if(!config.read(in)) {
+                cerr << "Bad configuration from " << address << endl;
+                status = 1;
+                break;
+            }
+            continue;
+        }
+        Summary part = config;
+        bool failed = false;	// reported to the coordinator with the partial
+        string kind, path;
+        size_t first, count;
+        while(in >> kind) {
+            if(kind == "A")
+                in >> first >> count;
+            in.get();
+            getline(in, path);
+            if(kind == "F") {
+                size_t size;
+                if(readPilotFile(path, buffer, size))
+                    part.add(CompactPilot(buffer.data(), Layout::detect(path, buffer.data(), size)), path);
+                else {
+                    cerr << "Cannot read pilot file " << path << endl;
+                    failed = true;
+                }
+                continue;
+            }
+            ArchiveSource archive;
+            if(!archive.open(path)) {
+                cerr << "Damaged archive " << path << endl;
+                failed = true;
+                continue;
+            }
+            archive.range(first, count);
+            string name;
+            const BYTE* record;
+            while(archive.next(name, record))
+                part.add(CompactPilot(record, archive.format()), name);
+            failed |= archive.failed();
+        }
+        if(failed)
+            status = 1;
+        ostringstream out;
+        part.write(out);
+        if(!sendMessage(fd, MSG_RESULT, out.str(), failed ? MSG_FAILED : 0))
+            break;	// the coordinator finished without this chunk
+    }
+    ::close(fd);
+    return status;
+}
+
+/**
+ * Lazy scanning API for programs embedding tfrdump (define TFRDUMP_NO_MAIN and include tfrdump.cpp):
+ * \code
+ * for(const tfr::PilotView& p : tfr::scan("/archive") | tfr::where(tfr::rank >= tfr::CAPTAIN))
+ *     cout << p.name() << " " << p.get(F_POINTS) << endl;
+ * \endcode
+ * scan() accepts everything the command line accepts (pilot file, directory, archive, "-"). Records are read one at a
+ * time while iterating, a PilotView decodes only the fields that are asked for and is valid until the iterator
+ * advances. where() and transform() wrap a range without storing anything but the function object.
+ */
+namespace tfr {
+
+enum Rank { CADET, OFFICER, LIEUTENANT, CAPTAIN, COMMANDER, GENERAL };
+
+/**
+ * A pilot record which decodes its fields on access.
+ */
+class PilotView {
+private:
+    const string* filename;
+    const BYTE* record;
+    const Layout* layout;
+
+public:
+    PilotView() : filename(0), record(0), layout(&Layout::builtin()) {}
+    PilotView(const string& filename, const BYTE* record, const Layout& layout = Layout::builtin())
+        : filename(&filename), record(record), layout(&layout) {}
+
+    const string& name() const
+    {
+        return *filename;
+    }
+
+    const BYTE* data() const
+    {
+        return record;
+    }
+
+    DWORD get(PilotFieldId field, int index = 0) const
+    {
+        const PilotField& location = layout->fields[field];
+        if(index >= location.count)
+            return 0;
+        const BYTE* at = record + location.offset + index * location.width;
+        switch(location.width) {
+        case 1:
+            return at[0];
+        case 2:
+            return at[0] | at[1] << 8;
+        default:
+            return at[0] | at[1] << 8 | at[2] << 16 | (DWORD) at[3] << 24;
+        }
+    }
+
+    Rank navyrank() const
+    {
+        return Rank(get(F_NAVYRANK));
+    }
+
+    /**
+     * Decode all fields, e.g. to keep the pilot beyond the current iteration.
+     */
+    const Layout& format() const
+    {
+        return *layout;
+    }
+
+    Pilot decode() const
+    {
+        return Pilot(record, *layout);
+    }
+
+    /**
+     * Decode all fields without keeping the record, for large collections of pilots.
+     */
+    CompactPilot compact() const
+    {
+        return CompactPilot(record, *layout);
+    }
+};
+
+/**
+ * Input range over one RecordSource, see scan().
+ */
+class Scan {
+private:
+    struct State {
+        unique_ptr<RecordSource> source;
+        string name;
+        const BYTE* record;
+        PilotView view;
+    };
+    shared_ptr<State> state;
+
+public:
+    class iterator {
+    private:
+        State* state;
+
+    public:
+        typedef input_iterator_tag iterator_category;
+        typedef PilotView value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const PilotView* pointer;
+        typedef const PilotView& reference;
+
+        explicit iterator(State* state = 0) : state(state)
+        {
+            if(state && !state->source)
+                this->state = 0;
+            else if(state)
+                ++*this;
+        }
+
+        const PilotView& operator*() const
+        {
+            return state->view;
+        }
+
+        const PilotView* operator->() const
+        {
+            return &state->view;
+        }
+
+        iterator& operator++()
+        {
+            if(state->source->next(state->name, state->record))
+                state->view = PilotView(state->name, state->record, state->source->format());
+            else
+                state = 0;
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return state == other.state;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return state != other.state;
+        }
+    };
+
+    explicit Scan(const string& path) : state(new State)
+    {
+        state->source = openSource(path);
+        state->record = 0;
+    }
+
+    /**
+     * Starts reading, a scan can only be iterated once.
+     */
+    iterator begin() const
+    {
+        return iterator(state.get());
+    }
+
+    iterator end() const
+    {
+        return iterator();
+    }
+};
+
+inline Scan scan(const string& path)
+{
+    return Scan(path);
+}
+
+/**
+ * Range of the elements of R for which P returns true, see where().
+ */
+template<typename R, typename P>
+class Filtered {
+private:
+    R range;
+    P predicate;
+
+public:
+    typedef typename R::iterator base;
+
+    class iterator {
+    private:
+        base position;
+        base last;
+        const P* predicate;
+
+        void skip()
+        {
+            while(position != last && !(*predicate)(*position))
+                ++position;
+        }
+
+    public:
+        typedef input_iterator_tag iterator_category;
+        typedef typename iterator_traits<base>::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename iterator_traits<base>::pointer pointer;
+        typedef typename iterator_traits<base>::reference reference;
+
+        iterator(base position, base last, const P* predicate) : position(position), last(last), predicate(predicate)
+        {
+            skip();
+        }
+
+        reference operator*() const
+        {
+            return *position;
+        }
+
+        iterator& operator++()
+        {
+            ++position;
+            skip();
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return position == other.position;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return position != other.position;
+        }
+    };
+
+    Filtered(const R& range, const P& predicate) : range(range), predicate(predicate) {}
+
+    iterator begin() const
+    {
+        return iterator(range.begin(), range.end(), &predicate);
+    }
+
+    iterator end() const
+    {
+        return iterator(range.end(), range.end(), &predicate);
+    }
+};
+
+/**
+ * Range of F applied to the elements of R, see transform().
+ */
+template<typename R, typename F>
+class Transformed {
+private:
+    R range;
+    F function;
+
+public:
+    typedef typename R::iterator base;
+
+    class iterator {
+    private:
+        base position;
+        const F* function;
+
+    public:
+        typedef decltype(declval<const F&>()(declval<typename iterator_traits<base>::reference>())) value_type;
+        typedef input_iterator_tag iterator_category;
+        typedef ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef value_type reference;
+
+        iterator(base position, const F* function) : position(position), function(function) {}
+
+        value_type operator*() const
+        {
+            return (*function)(*position);
+        }
+
+        iterator& operator++()
+        {
+            ++position;
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return position == other.position;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return position != other.position;
+        }
+    };
+
+    Transformed(const R& range, const F& function) : range(range), function(function) {}
+
+    iterator begin() const
+    {
+        return iterator(range.begin(), &function);
+    }
+
+    iterator end() const
+    {
+        return iterator(range.end(), &function);
+    }
+};
+
+template<typename P>
+struct WhereAdaptor {
+    P predicate;
+};
+
+template<typename F>
+struct TransformAdaptor {
+    F function;
+};
+
+template<typename P>
+WhereAdaptor<P> where(P predicate)
+{
+    WhereAdaptor<P> adaptor = { predicate };
+    return adaptor;
+}
+
+template<typename F>
+TransformAdaptor<F> transform(F function)
+{
+    TransformAdaptor<F> adaptor = { function };
+    return adaptor;
+}
+
+template<typename R, typename P>
+Filtered<R, P> operator|(const R& range, const WhereAdaptor<P>& adaptor)
+{
+    return Filtered<R, P>(range, adaptor.predicate);
+}
+
+template<typename R, typename F>
+Transformed<R, F> operator|(const R& range, const TransformAdaptor<F>& adaptor)
+{
+    return Transformed<R, F>(range, adaptor.function);
+}
+
+/**
+ * A comparison of one field with a constant, made by comparing a Field: tfr::points > 100000
+ */
+struct Condition {
+    PilotFieldId field;
+    int index;
+    QueryOp op;
+    DWORD value;
+
+    bool operator()(const PilotView& p) const
+    {
+        BYTE match = 1;
+        DWORD actual = p.get(field, index);
+        filterBlock(&actual, 1, op, value, &match);
+        return match;
+    }
+};
+
+/**
+ * Placeholder for a field (or one element of an array field) in conditions.
+ */
+struct Field {
+    PilotFieldId field;
+    int index;
+
+    Field(PilotFieldId field, int index = 0) : field(field), index(index) {}
+
+    Field operator[](int element) const
+    {
+        return Field(field, element);
+    }
+
+    Condition compare(QueryOp op, DWORD value) const
+    {
+        Condition condition = { field, index, op, value };
+        return condition;
+    }
+};
+
+inline Condition operator==(const Field& f, DWORD v)
+{
+    return f.compare(OP_EQ, v);
+}
+
+inline Condition operator!=(const Field& f, DWORD v)
+{
+    return f.compare(OP_NE, v);
+}
+
+inline Condition operator<(const Field& f, DWORD v)
+{
+    return f.compare(OP_LT, v);
+}
+
+inline Condition operator<=(const Field& f, DWORD v)
+{
+    return f.compare(OP_LE, v);
+}
+
+inline Condition operator>(const Field& f, DWORD v)
+{
+    return f.compare(OP_GT, v);
+}
+
+inline Condition operator>=(const Field& f, DWORD v)
+{
+    return f.compare(OP_GE, v);
+}
+
+const Field rank(F_NAVYRANK);
+const Field difficulty(F_DIFFICULTY);
+const Field points(F_POINTS);
+const Field secretrank(F_SECRETRANK);
+const Field battlestatus(F_BATTLESTATUS);
+const Field kills(F_KILLS);
+const Field total(F_TOTAL);
+
+}
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+/**
+ * Asynchronous scanning for coroutine based programs (C++20):
+ * \code
+ * tfr::AsyncGenerator<tfr::AsyncPilot> pilots = tfr::async_scan("/archive", pool);
+ * while(tfr::AsyncPilot* p = co_await pilots.next())
+ *     handle(p->view());
+ * \endcode
+ * The directory walk and all file reads run on the ThreadPool, up to twice its size reads are in flight. The awaiting
+ * coroutine is resumed on the pool thread which completed the read, so no thread ever blocks waiting for tfrdump.
+ */
+namespace tfr {
+
+/**
+ * A pilot yielded by async_scan(), it owns its record.
+ */
+struct AsyncPilot {
+    string name;
+    PilotBuffer record;
+    const Layout* layout;
+
+    AsyncPilot() : layout(&Layout::builtin()) {}
+
+    PilotView view() const
+    {
+        return PilotView(name, record.data(), *layout);
+    }
+};
+
+/**
+ * Generator whose body may co_await, consumed with co_await next() which returns a null pointer at the end.
+ */
+template<typename T>
+class AsyncGenerator {
+public:
+    struct promise_type;
+    typedef coroutine_handle<promise_type> handle;
+
+    /**
+     * Continue with the consumer after a co_yield or at the end of the generator.
+     */
+    struct Transfer {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        coroutine_handle<> await_suspend(handle producer) noexcept
+        {
+            return producer.promise().consumer;
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type {
+        T* value = nullptr;
+        coroutine_handle<> consumer;
+        exception_ptr error;
+
+        AsyncGenerator get_return_object()
+        {
+            return AsyncGenerator(handle::from_promise(*this));
+        }
+
+        suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        Transfer final_suspend() noexcept
+        {
+            value = nullptr;
+            return {};
+        }
+
+        Transfer yield_value(T& v) noexcept
+        {
+            value = addressof(v);
+            return {};
+        }
+
+        Transfer yield_value(T&& v) noexcept
+        {
+            value = addressof(v);
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception()
+        {
+            error = current_exception();
+        }
+    };
+
+    struct Next {
+        handle producer;
+
+        bool await_ready()
+        {
+            return producer.done();
+        }
+
+        coroutine_handle<> await_suspend(coroutine_handle<> consumer)
+        {
+            producer.promise().consumer = consumer;
+            return producer;
+        }
+
+        T* await_resume()
+        {
+            if(!producer.done())
+                return producer.promise().value;
+            if(producer.promise().error)
+                rethrow_exception(producer.promise().error);
+            return nullptr;
+        }
+    };
+
+    explicit AsyncGenerator(handle coroutine) : coroutine(coroutine) {}
+
+    AsyncGenerator(AsyncGenerator&& other) : coroutine(other.coroutine)
+    {
+        other.coroutine = nullptr;
+    }
+
+    AsyncGenerator(const AsyncGenerator&) = delete;
+    AsyncGenerator& operator=(const AsyncGenerator&) = delete;
+
+    ~AsyncGenerator()
+    {
+        if(coroutine)
+            coroutine.destroy();
+    }
+
+    /**
+     * Resume the generator until it yields the next value or ends.
+     */
+    Next next()
+    {
+        return Next{coroutine};
+    }
+
+private:
+    handle coroutine;
+};
+
+/**
+ * Completion state of a task on the ThreadPool, shared by the task and its Pending.
+ */
+class Completion {
+private:
+    mutex lock;
+    bool done = false;
+    coroutine_handle<> waiter;
+
+public:
+    void complete()
+    {
+        coroutine_handle<> resume;
+        {
+            lock_guard<mutex> guard(lock);
+            done = true;
+            resume = waiter;
+        }
+        if(resume)
+            resume.resume();
+    }
+
+    bool await_ready()
+    {
+        lock_guard<mutex> guard(lock);
+        return done;
+    }
+
+    bool await_suspend(coroutine_handle<> coroutine)
+    {
+        lock_guard<mutex> guard(lock);
+        if(done)
+            return false;
+        waiter = coroutine;
+        return true;
+    }
+
+    void await_resume() {}
+};
+
+/**
+ * Awaitable handle of a task started by runOn().
+ */
+struct Pending {
+    shared_ptr<Completion> completion;
+
+    bool await_ready()
+    {
+        return completion->await_ready();
+    }
+
+    bool await_suspend(coroutine_handle<> coroutine)
+    {
+        return completion->await_suspend(coroutine);
+    }
+
+    void await_resume() {}
+};
+
+/**
+ * Run task on the pool, co_await the result to continue on the pool thread once it is done.
+ */
+inline Pending runOn(ThreadPool& pool, function<void()> task)
+{
+    shared_ptr<Completion> completion = make_shared<Completion>();
+    pool.submit([completion, task] {
+        task();
+        completion->complete();
+    });
+    return Pending{completion};
+}
+
+/**
+ * Yield all pilots of path (pilot file, directory, archive or "-") as their reads complete on pool.
+ * Files are read concurrently, archives and stdin are sequential sources which are read on the pool one by one.
+ */
+inline AsyncGenerator<AsyncPilot> async_scan(string path, ThreadPool& pool)
+{
+    if(path == "-" || isArchive(path)) {
+        shared_ptr<RecordSource> source;
+        co_await runOn(pool, [&source, &path] { source = openSource(path); });
+        while(source) {
+            shared_ptr<AsyncPilot> pilot = make_shared<AsyncPilot>();
+            bool ok = false;
+            co_await runOn(pool, [&] {
+                const BYTE* record;
+                ok = source->next(pilot->name, record);
+                if(ok) {
+                    copy(record, record + PILOTFILESIZE, pilot->record.begin());
+                    pilot->layout = &source->format();
+                }
+            });
+            if(!ok)
+                break;
+            co_yield *pilot;
+        }
+        co_return;
+    }
+
+    vector<string> files;
+    co_await runOn(pool, [&files, &path] { collectPilotFiles(path, files); });
+    struct Read {
+        Pending completion;
+        shared_ptr<AsyncPilot> pilot;
+        shared_ptr<bool> ok;
+    };
+    deque<Read> inflight;
+    size_t nextfile = 0;
+    while(nextfile < files.size() || !inflight.empty()) {
+        while(nextfile < files.size() && inflight.size() < 2 * pool.size()) {
+            Read read = { Pending(), make_shared<AsyncPilot>(), make_shared<bool>(false) };
+            read.pilot->name = files[nextfile++];
+            shared_ptr<AsyncPilot> pilot = read.pilot;
+            shared_ptr<bool> ok = read.ok;
+            read.completion = runOn(pool, [pilot, ok] {
+                size_t size;
+                *ok = readPilotFile(pilot->name, pilot->record, size);
+                pilot->layout = &Layout::detect(pilot->name, pilot->record.data(), size);
+            });
+            inflight.push_back(read);
+        }
+        Read read = inflight.front();
+        inflight.pop_front();
+        co_await read.completion;
+        if(!*read.ok) {
+            cerr << "Cannot read pilot file " << read.pilot->name << endl;
+            continue;
+        }
+        co_yield *read.pilot;
+    }
+}
+
+}
+#endif
+
+/**
+ * Write-ahead journal of tfrdump patch. Before any pilot file or archive is changed, the original and the new BYTEs of
+ * every change are appended to the journal and the journal is flushed with fdatasync, one flush for a whole group of
+ * changes. A crash therefore never leaves a changed BYTE without its original in the journal, and rollback() can
+ * always restore the state before the patch. Entries which were not completely written (a crash while appending) are
+ * recognised by their checksum; their changes were never applied.
+ *
+ * The file starts with JOURNALMAGIC, followed by the entries (host byte order): a JournalEntry, the path, the
+ * original and the new BYTEs.
+ */
+struct JournalEntry {
+    uint32_t pathlength;
+    uint32_t length;	// BYTEs changed
+    uint64_t offset;	// in the file
+    uint64_t checksum;	// fnv1a() of the entry with checksum 0
+};
+
+const char JOURNALMAGIC[8] = {'T', 'F', 'R', 'J', 'R', 'N', 'L', '1'};
+
+class PatchJournal {
+public:
+    static const size_t GROUPCHANGES = 4096;	// changes per fdatasync of the journal
+
+    /**
+     * One change of length BYTEs at offset in the file path.
+     */
+    struct Change {
+        string path;
+        uint64_t offset;
+        string original;
+        string patched;
+    };
+
+    PatchJournal() : fd(-1), changes(0) {}
+
+    ~PatchJournal()
+    {
+        if(fd >= 0)
+            ::close(fd);
+    }
+
+    bool create(const string&);
+    bool add(Change);
+    bool commit();
+    void report(ostream&) const;
+
+    static int rollback(const string&);
+
+private:
+    int fd;
+    string pending;	// journal entries not yet written
+    vector<Change> group;	// their changes, applied after the journal is flushed
+    set<string> files;	// every file changed so far
+    string lastpath, lastresolved;	// the last path given to add() and its realpath()
+    size_t changes;
+
+    static bool writeAll(int, const char*, size_t, uint64_t);
+    static bool appendAll(int, const char*, size_t);
+};
+
+/**
+ * pwrite() all size BYTEs.
+ */
+bool PatchJournal::writeAll(int fd, const char* data, size_t size, uint64_t offset)
+{
+    while(size) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * write() all size BYTEs at the end of the O_APPEND file fd.
+ */
+bool PatchJournal::appendAll(int fd, const char* data, size_t size)
+{
+    while(size) {
+        ssize_t n = ::write(fd, data, size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * Start a new journal, an existing one is never overwritten: it may be the only way back.
+ */
+bool PatchJournal::create(const string& path)
+{
+    fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_APPEND, 0644);
+    if(fd < 0) {
+        cerr << "Cannot create journal " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    pending.assign(JOURNALMAGIC, sizeof(JOURNALMAGIC));
+    return true;
+}
+
+/**
+ * Queue a change, every GROUPCHANGES changes the group is committed. The journal records the absolute path of the
+ * file, so --rollback restores the same file from any directory.
+ */
+bool PatchJournal::add(Change change)
+{
+    if(change.path != lastpath) {	// archive changes come in long runs for one file
+        char* absolute = realpath(change.path.c_str(), 0);
+        if(!absolute) {
+            cerr << "Cannot resolve " << change.path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        lastpath = change.path;
+        lastresolved = absolute;
+        free(absolute);
+    }
+    change.path = lastresolved;
+    JournalEntry entry = { (uint32_t) change.path.size(), (uint32_t) change.original.size(), change.offset, 0 };
+    size_t start = pending.size();
+    pending.append((const char*) &entry, sizeof(entry));
+    pending += change.path;
+    pending += change.original;
+    pending += change.patched;
+    entry.checksum = fnv1a((const BYTE*) pending.data() + start, pending.size() - start);
+    memcpy(&pending[start + offsetof(JournalEntry, checksum)], &entry.checksum, sizeof(entry.checksum));
+    group.push_back(change);
+    return group.size() < GROUPCHANGES || commit();
+}
+
+/**
+ * Write and flush the journal entries of the group, then apply its changes. The changed files are flushed once at the
+ * end of the patch (see report()), until then the journal has everything to undo them.
+ */
+bool PatchJournal::commit()
+{
+    if(!appendAll(fd, pending.data(), pending.size()) || fdatasync(fd) != 0) {
+        cerr << "Cannot write journal: " << strerror(errno) << endl;
+        return false;
+    }
+    pending.clear();
+    bool ok = true;
+    int target = -1;
+    string open;
+    for(size_t i=0; i<group.size(); ++i) {
+        const Change& change = group[i];
+        if(change.path != open) {	// changes of one file are consecutive
+            if(target >= 0)
+                ::close(target);
+            open = change.path;
+            target = ::open(open.c_str(), O_WRONLY);
+            files.insert(open);
+        }
+        if(target < 0 || !writeAll(target, change.patched.data(), change.patched.size(), change.offset)) {
+            cerr << "Cannot patch " << change.path << ": " << strerror(errno) << endl;
+            ok = false;
+        } else
+            ++changes;
+    }
+    if(target >= 0)
+        ::close(target);
+    group.clear();
+    return ok;
+}
+
+/**
+ * Flush the changed files (syncfs() once per filesystem) and print what was done.
+ */
+void PatchJournal::report(ostream& out) const
+{
+    set<dev_t> synced;
+    for(set<string>::const_iterator i=files.begin(); i!=files.end(); ++i) {
+        struct stat st;
+        if(stat(i->c_str(), &st) != 0 || !synced.insert(st.st_dev).second)
+            continue;
+        int fd = ::open(i->c_str(), O_RDONLY);
+        if(fd >= 0) {
+            syncfs(fd);
+            ::close(fd);
+        }
+    }
+    out << "Made " << changes << " change(s) in " << files.size() << " file(s)" << endl;
+}
+
+/**
+ * tfrdump patch --rollback journal
+ *
+ * Restore the original BYTEs of all changes in the journal, the newest first. A change is only undone where the file
+ * still holds the patched (or, after a crash, the original) BYTEs, anything else was changed since and is reported.
+ */
+int PatchJournal::rollback(const string& path)
+{
+    ifstream in(path.c_str(), ios::in|ios::binary);
+    char magic[sizeof(JOURNALMAGIC)];
+    if(!in.read(magic, sizeof(magic)) || memcmp(magic, JOURNALMAGIC, sizeof(magic)) != 0) {
+        cerr << "Not a patch journal: " << path << endl;
+        return 1;
+    }
+    vector<Change> entries;
+    JournalEntry entry;
+    while(readBinary(in, entry)) {
+        string data(sizeof(entry) + entry.pathlength + 2 * (size_t) entry.length, 0);
+        if(!in.read(&data[sizeof(entry)], data.size() - sizeof(entry)))
+            break;
+        uint64_t checksum = entry.checksum;
+        entry.checksum = 0;
+        memcpy(&data[0], &entry, sizeof(entry));
+        if(fnv1a((const BYTE*) data.data(), data.size()) != checksum)
+            break;
+        Change change;
+        change.path = data.substr(sizeof(entry), entry.pathlength);
+        change.offset = entry.offset;
+        change.original = data.substr(sizeof(entry) + entry.pathlength, entry.length);
+        change.patched = data.substr(sizeof(entry) + entry.pathlength + entry.length);
+        entries.push_back(change);
+    }
+    if(!in.eof() || in.gcount())
+        cerr << "Ignoring the incomplete end of " << path << " after " << entries.size() << " change(s), it was never applied"
+             << endl;
+
+    int status = 0;
+    map<string, int> fds;
+    size_t restored = 0;
+    for(size_t i=entries.size(); i-- > 0; ) {
+        const Change& change = entries[i];
+        map<string, int>::iterator fd = fds.find(change.path);
+        if(fd == fds.end())
+            fd = fds.insert(make_pair(change.path, ::open(change.path.c_str(), O_RDWR))).first;
+        string current(change.original.size(), 0);
+        if(fd->second < 0 || pread(fd->second, &current[0], current.size(), change.offset) != (ssize_t) current.size()) {
+            cerr << "Cannot read " << change.path << endl;
+            status = 1;
+            continue;
+        }
+        if(current != change.patched && current != change.original) {
+            cerr << change.path << " was changed after patching at offset " << change.offset << ", not restored" << endl;
+            status = 1;
+            continue;
+        }
+        if(!writeAll(fd->second, change.original.data(), change.original.size(), change.offset)) {
+            cerr << "Cannot restore " << change.path << ": " << strerror(errno) << endl;
+            status = 1;
+            continue;
+        }
+        ++restored;
+    }
+    for(map<string, int>::iterator fd=fds.begin(); fd!=fds.end(); ++fd) {
+        if(fd->second >= 0 && (fdatasync(fd->second) != 0 || ::close(fd->second) != 0)) {
+            cerr << "Cannot restore " << fd->first << ": " << strerror(errno) << endl;
+            status = 1;
+        }
+    }
+    cout << "Undid " << restored << " of " << entries.size() << " change(s) in " << fds.size() << " file(s)" << endl;
+    return status;
+}
+
+/**
+ * A field assignment of --set: all elements of the field if index is -1.
+ */
+struct Assignment {
+    PilotFieldId field;
+    int index;
+    DWORD value;
+};
+
+/**
+ * Parse "points=1000", "kills_5=0" or "battlestatus=0" (every element). Fails for values the column cannot hold,
+ * parsePredicate() already refuses negative values and values beyond a DWORD, so nothing wraps around into range.
+ */
+bool parseAssignment(const string& text, Assignment& assignment)
+{
+    string column;
+    QueryOp op;
+    int field, index = -1;
+    if(!parsePredicate(text, column, op, assignment.value) || op != OP_EQ)
+        return false;
+    if(!parseColumnName(column, field, index)) {
+        for(field=0; field<F_COUNT && column != pilotfields[field].name; ++field)
+            ;
+        if(field == F_COUNT)
+            return false;
+    }
+    assignment.field = PilotFieldId(field);
+    assignment.index = index;
+    return pilotfields[field].width == 4 || assignment.value < (1U << 8 * pilotfields[field].width);
+}
+
+/**
+ * tfrdump patch --journal file --set column=value... [--where column<op>value]... [--layout file]... <inputs>...
+ * tfrdump patch --rollback journal
+ *
+ * Change fields of every pilot matching all --where conditions in place, in pilot files as well as in archives
+ * (whose index hashes are updated too). Every change is recorded in the journal first (see PatchJournal), so a
+ * patch interrupted by a crash or one that turns out wrong is undone with --rollback.
+ */
+int patchPilots(int argc, char* argv[])
+{
+    string journalpath, rollback;
+    vector<Assignment> assignments;
+    vector<tfr::Condition> conditions;
+    vector<string> inputs;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--journal" && i+1 < argc)
+            journalpath = argv[++i];
+        else if(arg == "--rollback" && i+1 < argc)
+            rollback = argv[++i];
+        else if(arg == "--set" && i+1 < argc) {
+            Assignment assignment;
+            if(!parseAssignment(argv[++i], assignment)) {
+                cerr << "Cannot set " << argv[i] << ", use column=value with a value that fits the column" << endl;
+                return -1;
+            }
+            assignments.push_back(assignment);
+        } else if(arg == "--where" && i+1 < argc) {
+            string column;
+            tfr::Condition condition;
+            int field;
+            if(!parsePredicate(argv[++i], column, condition.op, condition.value)
+                    || !parseColumnName(column, field, condition.index)) {
+                cerr << "Cannot parse condition " << argv[i] << endl;
+                return -1;
+            }
+            condition.field = PilotFieldId(field);
+            conditions.push_back(condition);
+        } else if(arg == "--layout" && i+1 < argc) {
+            if(!addLayoutFile(argv[++i]))
+                return -1;
+        } else
+            inputs.push_back(arg);
+    }
+    if(!rollback.empty())
+        return PatchJournal::rollback(rollback);
+    if(journalpath.empty() || assignments.empty() || inputs.empty()) {
+        cerr << "Usage: tfrdump patch --journal file --set column=value... [--where column<op>value]... "
+             << "[--layout file]... <TFR-File|directory|archive>...\n"
+             << "       tfrdump patch --rollback journal" << endl;
+        return -1;
+    }
+    if(find(inputs.begin(), inputs.end(), "-") != inputs.end()) {
+        cerr << "stdin cannot be patched" << endl;
+        return -1;
+    }
+    PatchJournal journal;
+    if(!journal.create(journalpath))
+        return 1;
+
+    int status = 0;
+    size_t skipped = 0;
+    for(size_t i=0; i<inputs.size() && status == 0; ++i) {
+        unique_ptr<RecordSource> source;
+        ArchiveSource* archive = 0;
+        if(isArchive(inputs[i])) {
+            archive = new ArchiveSource;
+            source.reset(archive);
+            if(!archive->open(inputs[i])) {
+                cerr << "Damaged archive " << inputs[i] << endl;
+                status = 1;
+                continue;
+            }
+        } else
+            source.reset(new FileSource(inputs[i]));
+        string name;
+        const BYTE* record;
+        while(status == 0 && source->next(name, record)) {
+            tfr::PilotView view(name, record, source->format());
+            bool match = true;
+            for(size_t c=0; c<conditions.size() && match; ++c)
+                match = conditions[c](view);
+            if(!match)
+                continue;
+            PilotBuffer patched;
+            copy(record, record + PILOTFILESIZE, patched.begin());
+            for(size_t a=0; a<assignments.size(); ++a) {
+                const PilotField& field = source->format().fields[assignments[a].field];
+                int first = max(assignments[a].index, 0);
+                int last = assignments[a].index < 0 ? field.count : min(assignments[a].index + 1, (int) field.count);
+                if(first >= last || (field.width < 4 && assignments[a].value >> 8 * field.width)) {
+                    ++skipped;	// not in this format or too narrow for the value
+                    continue;
+                }
+                for(int e=first; e<last; ++e)
+                    for(int b=0; b<field.width; ++b)
+                        patched[field.offset + e * field.width + b] = assignments[a].value >> 8 * b;
+            }
+            uint64_t base = 0, hash = 0, before = 0;
+            PatchJournal::Change change;
+            change.path = archive ? inputs[i] : name;
+            if(archive)
+                before = archive->locate(base, hash);
+            else {	// never write beyond the end of a short file
+                struct stat st;
+                size_t size = stat(name.c_str(), &st) == 0 ? min((size_t) st.st_size, PILOTFILESIZE) : 0;
+                fill(patched.begin() + size, patched.end(), 0x0);
+            }
+            size_t first = 0, end = PILOTFILESIZE;	// one change from the first to the last changed BYTE
+            while(first < end && patched[first] == record[first])
+                ++first;
+            while(end > first && patched[end - 1] == record[end - 1])
+                --end;
+            if(first == end)
+                continue;
+            change.offset = base + first;
+            change.original.assign((const char*) record + first, end - first);
+            change.patched.assign((const char*) patched.data() + first, end - first);
+            if(!journal.add(change))
+                status = 1;
+            if(archive) {
+                uint64_t after = fnv1a(patched.data(), PILOTFILESIZE);
+                change.offset = hash;
+                change.original.assign((const char*) &before, sizeof(before));
+                change.patched.assign((const char*) &after, sizeof(after));
+                if(!journal.add(change))
+                    status = 1;
+            }
+        }
+        if(source->failed())
+            status = 1;
+    }
+    if(!journal.commit())
+        status = 1;
+    journal.report(cout);
+    if(skipped)
+        cerr << "Skipped " << skipped << " assignment(s) to fields the format of the pilot lacks or stores too narrow"
+             << endl;
+    return status;
+}
+
+/**
+ * Read the 128 bit key of tfrdump seal and verify: 32 hex digits, whitespace is ignored, e.g. the output of
+ * <tt>od -An -tx1 -N16 /dev/urandom</tt>.
+ */
+bool readSealKey(const string& path, BYTE key[16])
+{
+    ifstream in(path.c_str());
+    string digits, word;
+    while(in >> word)
+        digits += word;
+    if(digits.size() != 32 || digits.find_first_not_of("0123456789abcdefABCDEF") != string::npos) {
+        cerr << "Key file " << path << " must hold 32 hex digits" << endl;
+        return false;
+    }
+    for(int i=0; i<16; ++i)
+        key[i] = strtoul(digits.substr(2 * i, 2).c_str(), 0, 16);
+    return true;
+}
+
+/**
+ * Seal of one pilot: CRC-32C and SipHash-2-4 MAC of its PILOTFILESIZE BYTEs.
+ */
+struct Seal {
+    uint32_t crc;
+    uint64_t mac;
+};
+
+/**
+ * tfrdump seal --key file --seals file [--layout file]... <inputs>...
+ * tfrdump verify --key file --seals file [--layout file]... <inputs>...
+ *
+ * seal writes one line "crc32c mac name" per pilot to the seals file, verify reads the pilots again and reports every
+ * pilot which was changed (its CRC differs), whose seal was not made with the key (the CRC fits but the MAC does not),
+ * which has no seal or which was sealed but is missing. The CRC tells accidental damage from a wrong or forged seal;
+ * only the MAC proves that a pilot is the one sealed, it cannot be computed without the key. Pilots are identified by
+ * name, so pilot files sealed before tfrdump pack verify in the archive as well. Both hashes together cost a few
+ * microseconds per pilot, far less than reading it.
+ */
+int sealPilots(int argc, char* argv[])
+{
+    bool verify = string(argv[0]) == "verify";
+    string keyfile, sealfile;
+    vector<string> inputs;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--key" && i+1 < argc)
+            keyfile = argv[++i];
+        else if(arg == "--seals" && i+1 < argc)
+            sealfile = argv[++i];
+        else if(arg == "--layout" && i+1 < argc) {
+            if(!addLayoutFile(argv[++i]))
+                return -1;
+        } else
+            inputs.push_back(arg);
+    }
+    if(keyfile.empty() || sealfile.empty() || inputs.empty()) {
+        cerr << "Usage: tfrdump " << argv[0] << " --key file --seals file [--layout file]... "
+             << "<TFR-File|directory|archive|->..." << endl;
+        return -1;
+    }
+    BYTE key[16];
+    if(!readSealKey(keyfile, key))
+        return -1;
+
+    map<string, Seal> seals;
+    ofstream out;
+    if(verify) {
+        ifstream in(sealfile.c_str());
+        if(!in) {
+            cerr << "Cannot read seals " << sealfile << endl;
+            return 1;
+        }
+        string line;
+        for(size_t number=1; getline(in, line); ++number) {
+            char* end;
+            Seal seal;
+            seal.crc = strtoul(line.c_str(), &end, 16);
+            bool ok = *end == ' ';
+            seal.mac = strtoull(end, &end, 16);
+            if(!ok || *end != ' ' || end[1] == 0) {
+                cerr << sealfile << ":" << number << ": expected crc32c, mac and name" << endl;
+                return 1;
+            }
+            seals[end + 1] = seal;
+        }
+    } else {
+        out.open(sealfile.c_str());
+        if(!out) {
+            cerr << "Cannot write seals " << sealfile << endl;
+            return 1;
+        }
+    }
+
+    int status = 0;
+    size_t pilots = 0, failures = 0;
+    set<string> seen;
+    for(size_t i=0; i<inputs.size(); ++i) {
+        unique_ptr<RecordSource> source = openSource(inputs[i]);
+        if(!source) {
+            status = 1;
+            continue;
+        }
+        string name;
+        const BYTE* record;
+        while(source->next(name, record)) {
+            ++pilots;
+            Seal seal = { crc32c(record, PILOTFILESIZE), siphash(key, record, PILOTFILESIZE) };
+            if(!verify) {
+                const char hex[] = "0123456789abcdef";
+                char line[8 + 1 + 16 + 1];
+                for(int d=0; d<8; ++d)
+                    line[d] = hex[seal.crc >> (28 - 4 * d) & 0xF];
+                line[8] = ' ';
+                for(int d=0; d<16; ++d)
+                    line[9 + d] = hex[seal.mac >> (60 - 4 * d) & 0xF];
+                line[25] = ' ';
+                out.write(line, sizeof(line)) << name << '\n';
+                continue;
+            }
+            map<string, Seal>::const_iterator sealed = seals.find(name);
+            const char* problem = 0;
+            if(sealed == seals.end())
+                problem = "unsealed";
+            else if(sealed->second.crc != seal.crc)
+                problem = "modified";
+            else if(sealed->second.mac != seal.mac)
+                problem = "forged seal";
+            if(sealed != seals.end())
+                seen.insert(name);
+            if(problem) {
+                cout << problem << ": " << name << '\n';
+                ++failures;
+            }
+        }
+        if(source->failed())
+            status = 1;
+    }
+    if(!verify) {
+        if(!out.flush()) {
+            cerr << "Cannot write seals " << sealfile << endl;
+            return 1;
+        }
+        cerr << "Sealed " << pilots << " pilot(s)" << endl;
+        return status;
+    }
+    for(map<string, Seal>::const_iterator i=seals.begin(); i!=seals.end(); ++i)
+        if(!seen.count(i->first)) {
+            cout << "missing: " << i->first << '\n';
+            ++failures;
+        }
+    cout << "Verified " << pilots << " pilot(s) against " << seals.size() << " seal(s), " << failures << " problem(s)"
+         << endl;
+    return failures ? 1 : status;
+}
+
+/**
+ * Print every column which differs between two decoded pilots as "column: old -> new", returns how many did.
+ */
+size_t printPilotDiff(const CompactPilot& before, const CompactPilot& after, ostream& out, const string& prefix)
+{
+    size_t changes = 0;
+    for(int f=0; f<F_COUNT; ++f)
+        for(int i=0; i<pilotfields[f].count; ++i) {
+            DWORD old = before.get(PilotFieldId(f), i), now = after.get(PilotFieldId(f), i);
+            if(old != now) {
+                out << prefix << columnName(f, i) << ": " << old << " -> " << now << '\n';
+                ++changes;
+            }
+        }
+    return changes;
+}
+
+#ifdef __linux__
+/**
+ * Read access to the memory of another process with process_vm_readv(), which needs the same permission as ptrace
+ * (same user and /proc/sys/kernel/yama/ptrace_scope 0, or CAP_SYS_PTRACE).
+ */
+class ProcessMemory {
+public:
+    explicit ProcessMemory(pid_t pid) : pid(pid) {}
+
+    /**
+     * Read size BYTEs at address, returns the number read: less at the end of a mapping, -1 if the process is gone
+     * or cannot be read (errno).
+     */
+    ssize_t read(uint64_t address, void* buffer, size_t size) const
+    {
+        struct iovec local = { buffer, size };
+        struct iovec remote = { (void*) (uintptr_t) address, size };
+        return process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    }
+
+    /**
+     * Addresses of the places in the readable mappings of the process where pattern is found at offset BYTEs into a
+     * block of PILOTFILESIZE BYTEs, i.e. the starts of these blocks. Stops after limit hits.
+     */
+    bool find(size_t offset, const string& pattern, vector<uint64_t>& found, size_t limit) const
+    {
+        ostringstream path;
+        path << "/proc/" << pid << "/maps";
+        ifstream maps(path.str().c_str());
+        if(!maps)
+            return false;
+        const size_t CHUNK = 1 << 20;
+        vector<char> buffer(CHUNK + pattern.size());
+        string line;
+        while(found.size() < limit && getline(maps, line)) {
+            istringstream fields(line);
+            uint64_t start, end;
+            char dash;
+            string perms;
+            if(!(fields >> hex >> start >> dash >> end >> perms) || perms[0] != 'r'
+                    || line.find("[vvar]") != string::npos || line.find("[vsyscall]") != string::npos)
+                continue;
+            for(uint64_t at=start; at + pattern.size() <= end && found.size() < limit; at+=CHUNK) {	// chunks overlap by the pattern size
+                ssize_t n = read(at, buffer.data(), min<uint64_t>(buffer.size(), end - at));
+                if(n < (ssize_t) pattern.size())
+                    break;
+                const char* data = buffer.data();
+                for(const char* hit; found.size() < limit && (hit = (const char*) memmem(data, buffer.data() + n - data,
+                        pattern.data(), pattern.size())); data = hit + 1) {
+                    uint64_t address = at + (hit - buffer.data());
+                    if(hit - buffer.data() < (ssize_t) CHUNK && address >= start + offset
+                            && address - offset + PILOTFILESIZE <= end)
+                        found.push_back(address - offset);
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    pid_t pid;
+};
+#endif
+
+/**
+ * tfrdump live --pid N [--like file|--address addr] [--interval ms] [--layout file]...
+ *
+ * Follow the pilot in the memory of a running game (e.g. the DOSBox process) instead of waiting until it writes the
+ * pilot file. The pilot block is found by a search over all readable mappings of the process (/proc/PID/maps): for
+ * an exact copy of the pilot file given by --like, which is what the game holds right after loading or saving it, or
+ * else for the signature of the last --layout which has one, or the block at --address. Every --interval
+ * milliseconds (default 200) the blocks are read again with process_vm_readv(). Several hits are usual (file buffers
+ * of the game and the emulator hold copies), the first block which changes is the pilot the game works on and the
+ * only one followed from then on. The pilot is printed once, then every changed column, until the process ends.
+ */
+int livePilot(int argc, char* argv[])
+{
+    const size_t MAXBLOCKS = 64;	// more hits mean the signature is too weak to find the pilot
+    pid_t pid = 0;
+    string like;
+    uint64_t address = 0;
+    int interval = 200;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--pid" && i+1 < argc)
+            pid = atoi(argv[++i]);
+        else if(arg == "--like" && i+1 < argc)
+            like = argv[++i];
+        else if(arg == "--address" && i+1 < argc)
+            address = strtoull(argv[++i], 0, 0);
+        else if(arg == "--interval" && i+1 < argc)
+            interval = atoi(argv[++i]);
+        else if(arg == "--layout" && i+1 < argc) {
+            if(!addLayoutFile(argv[++i]))
+                return -1;
+        } else {
+            pid = 0;
+            break;
+        }
+    }
+    if(pid <= 0 || interval <= 0) {
+        cerr << "Usage: tfrdump live --pid N [--like TFR-File|--address addr] [--interval ms] [--layout file]..."
+             << endl;
+        return -1;
+    }
+#ifdef __linux__
+    const Layout* layout = Layout::formats().back();
+    size_t offset = 0;
+    string pattern;
+    if(!like.empty()) {
+        PilotBuffer buffer;
+        size_t size;
+        if(!readPilotFile(like, buffer, size)) {
+            cerr << "Cannot read pilot file " << like << endl;
+            return 1;
+        }
+        layout = &Layout::detect(like, buffer.data(), size);
+        pattern.assign((const char*) buffer.data(), size);
+    } else {
+        const vector<const Layout*>& known = Layout::formats();
+        for(size_t i=known.size(); i-- > 0 && pattern.empty(); )
+            if(!known[i]->signature.empty()) {
+                layout = known[i];
+                offset = layout->signatureoffset;
+                pattern = layout->signature;
+            }
+    }
+    ProcessMemory memory(pid);
+    vector<uint64_t> blocks(1, address);
+    if(!address) {
+        blocks.clear();
+        if(pattern.empty()) {
+            cerr << "Nothing to search for: give --like, --address or a --layout with a signature" << endl;
+            return -1;
+        }
+        if(!memory.find(offset, pattern, blocks, MAXBLOCKS + 1)) {
+            cerr << "Cannot read the mappings of process " << pid << endl;
+            return 1;
+        }
+        if(blocks.empty()) {
+            cerr << "No pilot found in process " << pid << " (is it readable, see ptrace_scope?)" << endl;
+            return 1;
+        }
+        if(blocks.size() > MAXBLOCKS) {
+            cerr << "More than " << MAXBLOCKS << " matches in process " << pid << ", the signature is too common" << endl;
+            return 1;
+        }
+        for(size_t i=0; i<blocks.size(); ++i)
+            cerr << "Pilot block at 0x" << hex << blocks[i] << dec << endl;
+    }
+
+    vector<PilotBuffer> records(blocks.size());
+    for(size_t i=0; i<blocks.size(); ++i) {
+        records[i].fill(0x0);
+        if(memory.read(blocks[i], records[i].data(), layout->size) != (ssize_t) layout->size) {
+            cerr << "Cannot read process " << pid << ": " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+    CompactPilot previous(records[0].data(), *layout);
+    cout << previous << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool ended = false;
+    while(!blocks.empty() && !ended) {
+        this_thread::sleep_for(chrono::milliseconds(interval));
+        for(size_t i=0; i<blocks.size() && !ended; ++i) {
+            PilotBuffer record = records[i];
+            if(memory.read(blocks[i], record.data(), layout->size) != (ssize_t) layout->size) {
+                ended = errno == ESRCH;
+                if(ended)
+                    continue;
+                blocks.erase(blocks.begin() + i);	// unmapped, e.g. a freed file buffer
+                records.erase(records.begin() + i--);
+                continue;
+            }
+            if(record == records[i])
+                continue;
+            if(blocks.size() > 1) {
+                cerr << "Following the pilot block at 0x" << hex << blocks[i] << dec << endl;
+                previous = CompactPilot(records[i].data(), *layout);
+                blocks.assign(1, blocks[i]);
+                records.assign(1, records[i]);
+                i = 0;
+            }
+            records[i] = record;
+            CompactPilot current(record.data(), *layout);
+            ostringstream prefix;
+            prefix << "+" << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count()
+                   << "ms ";
+            if(printPilotDiff(previous, current, cout, prefix.str()))
+                cout << flush;
+            previous = current;
+        }
+    }
+    if(ended) {
+        cerr << "Process " << pid << " ended" << endl;
+        return 0;
+    }
+    cerr << "No pilot block left in process " << pid << endl;
+    return 1;
+#else
+    cerr << "tfrdump live needs Linux (/proc and process_vm_readv)" << endl;
+    return 1;
+#endif
+}
+
+/**
+ * Side by side view of several pilots for tfrdump compare: one column per pilot, one row per value (rank, points,
+ * certificates, medals, battles, kills per ship). Rows whose values differ are marked, rows which are empty for every
+ * pilot are left out.
+ */
+class PilotComparison {
+private:
+    struct Row {
+        string label;
+        vector<string> cells;
+        bool differs;
+    };
+
+    vector<string> headers;
+    vector<Row> rows;
+
+    template<typename F>
+    void add(const string& label, const vector<CompactPilot>& pilots, F cell)
+    {
+        Row row = { label, vector<string>(), false };
+        for(size_t i=0; i<pilots.size(); ++i) {
+            ostringstream text;
+            text << cell(pilots[i]);
+            row.cells.push_back(text.str());
+            row.differs |= row.cells[i] != row.cells[0];
+        }
+        rows.push_back(row);
+    }
+
+public:
+    PilotComparison(const vector<string>&, const vector<CompactPilot>&);
+    void print(ostream&, bool) const;
+};
+
+PilotComparison::PilotComparison(const vector<string>& names, const vector<CompactPilot>& pilots)
+{
+    typedef const CompactPilot& P;
+    set<string> unique;
+    for(size_t i=0; i<names.size(); ++i) {
+        headers.push_back(names[i].substr(names[i].find_last_of('/') + 1));
+        unique.insert(headers.back());
+    }
+    if(unique.size() < headers.size())	// the same file name in several directories, show the paths
+        headers = names;
+    add("Navyrank", pilots, [](P p) {
+        return p.navyrank_toString();
+    });
+    add("Secret order", pilots, [](P p) {
+        return p.secretrank_toString();
+    });
+    add("Difficulty", pilots, [](P p) {
+        return p.difficulty_toString();
+    });
+    add("Points", pilots, [](P p) {
+        return p.points;
+    });
+    add("Level", pilots, [](P p) {
+        return p.level;
+    });
+
+    static const char* const ships[] = {"T/F", "T/I", "T/B", "T/A", "Gunboat", "T/D", "Missile Boat"};
+    for(int s=0; s<7; ++s)
+        add(string(ships[s]) + " certificate", pilots, [s](P p) {
+        return p.get(PilotFieldId(F_TF_CERT + s)) == 0x4 ? "yes" : "-";
+    });
+    for(int s=0; s<7; ++s)
+        add(string(ships[s]) + " medal", pilots, [s](P p) {
+        PilotFieldId sim = PilotFieldId(F_TF_SIM + s);
+        return p.getmedal(p.get(sim, 0) + p.get(sim, 1) + p.get(sim, 2) + p.get(sim, 3));
+    });
+
+    add("Active battle", pilots, [](P p) {
+        return p.activebattle + 1;
+    });
+    for(size_t b=0; b<13; ++b) {
+        bool used = false;
+        for(size_t i=0; i<pilots.size() && !used; ++i)
+            used = pilots[i].battlestatus[b] != 0;
+        if(used)
+            add("Battle " + to_string(b + 1), pilots, [b](P p) -> string {
+            static const char* const status[] = {"-", "active", "captured/killed", "completed", "captured/killed"};
+            if(p.battlestatus[b] > 4)
+                return "unknown";
+            return p.battlestatus[b] ? status[p.battlestatus[b]] + string(" ") + to_string(p.missionchoose[b])
+                   : status[0];
+        });
+    }
+
+    add("Lasers fired", pilots, [](P p) {
+        return p.lasersfired;
+    });
+    add("Laser hits", pilots, [](P p) {
+        return p.laserhits;
+    });
+    add("Warheads fired", pilots, [](P p) {
+        return p.warheadsfired;
+    });
+    add("Warhead hits", pilots, [](P p) {
+        return p.warheadhits;
+    });
+    add("Total kills", pilots, [](P p) {
+        return p.total;
+    });
+    add("Ships captured", pilots, [](P p) {
+        return p.captured;
+    });
+    add("Ships lost", pilots, [](P p) {
+        return p.lost;
+    });
+
+    array<WORD,68> killed = {};	// not zero where any pilot has kills
+    for(size_t i=0; i<pilots.size(); ++i)
+        orWords(pilots[i].kills.data(), killed.data(), killed.size());
+    for(size_t k=0; k<killed.size(); ++k)
+        if(killed[k])
+            add(string("Kills ") + CompactPilot::shipnames[k], pilots, [k](P p) {
+            return p.kills[k];
+        });
+}
+
+/**
+ * Print the table, rows with differences are marked with '*' and, with color, the values which differ from the first
+ * pilot's are shown in bold.
+ */
+void PilotComparison::print(ostream& out, bool color) const
+{
+    size_t labelwidth = 0;
+    vector<size_t> widths(headers.size());
+    for(size_t c=0; c<headers.size(); ++c)
+        widths[c] = headers[c].size();
+    for(size_t r=0; r<rows.size(); ++r) {
+        labelwidth = max(labelwidth, rows[r].label.size());
+        for(size_t c=0; c<headers.size(); ++c)
+            widths[c] = max(widths[c], rows[r].cells[c].size());
+    }
+    ostringstream table;
+    table << "  " << string(labelwidth, ' ');
+    for(size_t c=0; c<headers.size(); ++c)
+        table << "  " << string(widths[c] - headers[c].size(), ' ') << headers[c];
+    table << '\n';
+    for(size_t r=0; r<rows.size(); ++r) {
+        const Row& row = rows[r];
+        table << (row.differs ? "* " : "  ") << row.label << string(labelwidth - row.label.size(), ' ');
+        for(size_t c=0; c<headers.size(); ++c) {
+            table << "  " << string(widths[c] - row.cells[c].size(), ' ');
+            if(color && row.cells[c] != row.cells[0])
+                table << "\033[1m" << row.cells[c] << "\033[0m";
+            else
+                table << row.cells[c];
+        }
+        table << '\n';
+    }
+    out << table.str() << flush;
+}
+
+/**
+ * tfrdump compare [--color always|never|auto] [--layout file]... <inputs>...
+ *
+ * Print all pilots of the inputs side by side (PilotComparison). The inputs are read and decoded in parallel, one task
+ * per pilot file (directories are split into their files) or archive, and the table is rendered once at the end. Colors
+ * are used on terminals by default. stdin can be compared once.
+ */
+int comparePilots(int argc, char* argv[])
+{
+    string color = "auto";
+    vector<string> inputs;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--color" && i+1 < argc)
+            color = argv[++i];
+        else if(arg == "--layout" && i+1 < argc) {
+            if(!addLayoutFile(argv[++i]))
+                return -1;
+        } else
+            inputs.push_back(arg);
+    }
+    if(inputs.empty() || (color != "auto" && color != "always" && color != "never")) {
+        cerr << "Usage: tfrdump compare [--color always|never|auto] [--layout file]... <TFR-File|directory|archive|->..."
+             << endl;
+        return -1;
+    }
+    if(count(inputs.begin(), inputs.end(), "-") > 1) {
+        cerr << "stdin can only be compared once" << endl;
+        return -1;
+    }
+    vector<string> tasks;
+    for(size_t i=0; i<inputs.size(); ++i)
+        collectPilotFiles(inputs[i], tasks);
+
+    struct Decoded {
+        vector<string> names;
+        vector<CompactPilot> pilots;
+        bool ok;
+    };
+    ThreadPool pool(min(tasks.size(), (size_t) max(thread::hardware_concurrency(), 1U)));
+    vector<future<Decoded> > decoded;
+    for(size_t i=0; i<tasks.size(); ++i) {
+        string input = tasks[i];
+        decoded.push_back(pool.submit([input]() -> Decoded {
+            Decoded result;
+            unique_ptr<RecordSource> source = openSource(input);
+            result.ok = bool(source);
+            string name;
+            const BYTE* record;
+            while(source && source->next(name, record)) {
+                result.names.push_back(name);
+                result.pilots.push_back(CompactPilot(record, source->format()));
+            }
+            result.ok = result.ok && !source->failed();
+            return result;
+        }));
+    }
+    int status = 0;
+    vector<string> names;
+    vector<CompactPilot> pilots;
+    for(size_t i=0; i<decoded.size(); ++i) {
+        Decoded result = decoded[i].get();
+        if(!result.ok)
+            status = 1;
+        names.insert(names.end(), result.names.begin(), result.names.end());
+        pilots.insert(pilots.end(), result.pilots.begin(), result.pilots.end());
+    }
+    if(pilots.empty()) {
+        cerr << "No pilots to compare" << endl;
+        return 1;
+    }
+    PilotComparison(names, pilots).print(cout, color == "always" || (color == "auto" && isatty(STDOUT_FILENO)));
+    return status;
+}
+
+#ifndef TFRDUMP_NO_MAIN
+int main(int argc, char* argv[])
+{
+    if(argc > 1 && string(argv[1]) == "query")
+        return queryColumns(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "pack")
+        return packArchive(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "patch")
+        return patchPilots(argc - 1, argv + 1);
+    if(argc > 1 && (string(argv[1]) == "seal" || string(argv[1]) == "verify"))
+        return sealPilots(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "live")
+        return livePilot(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "compare")
+        return comparePilots(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "summary")
+        return summarize(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "merge")
+        return mergePartials(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "coordinator")
+        return runCoordinator(argc - 1, argv + 1);
+    if(argc > 1 && string(argv[1]) == "worker")
+        return runWorker(argc - 1, argv + 1);
+
+    vector<string> inputs;
+    vector<string> outputs;
+    string compress;
+    string stats;
+    bool printlayout = false;
+    for(int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if(arg == "--out" && i+1 < argc)
+            outputs.push_back(argv[++i]);
+        else if(arg.compare(0, 6, "--out=") == 0)
+            outputs.push_back(arg.substr(6));
+        else if(arg == "--format" && i+1 < argc)
+            outputs.push_back(argv[++i]);
+        else if(arg.compare(0, 9, "--format=") == 0)
+            outputs.push_back(arg.substr(9));
+        else if(arg == "--compress" && i+1 < argc)
+            compress = argv[++i];
+        else if(arg.compare(0, 11, "--compress=") == 0)
+            compress = arg.substr(11);
+        else if(arg == "--no-cache-pollution")
+            nocachepollution = true;
+        else if(arg == "--layout" && i+1 < argc) {
+            if(!addLayoutFile(argv[++i]))
+                return -1;
+        } else if(arg == "--print-layout")
+            printlayout = true;
+        else if(arg == "--stats")
+            stats = "phases";
+        else if(arg.compare(0, 8, "--stats=") == 0)
+            stats = arg.substr(8);
+        else
+            inputs.push_back(arg);
+    }
+    if(printlayout) {
+        const vector<const Layout*>& formats = Layout::formats();
+        for(size_t i=0; i<formats.size(); ++i) {
+            if(i)
+                cout << endl;
+            formats[i]->print(cout);
+        }
+        return 0;
+    }
+    if(inputs.empty()) {
+        cerr << "Please name a pilot file as parameter" << endl;
+        return -1;
+    }
+    if(outputs.empty())
+        outputs.push_back("text");
+    Compression compression = COMPRESS_NONE;
+    int level = 0;
+    if(!compress.empty() && !parseCompression(compress, compression, level)) {
+        cerr << "Unknown, not compiled in or invalid compression " << compress << endl;
+        return -1;
+    }
+    if(!stats.empty() && stats != "phases" && stats != "files") {
+        cerr << "Unknown statistics " << stats << ", use --stats or --stats=files" << endl;
+        return -1;
+    }
+    unique_ptr<Stats> statistics(stats.empty() ? 0 : new Stats(stats == "files"));
+    PerfCounters perf;
+    if(statistics)
+        statistics->counting(perf.open());
+    ThreadPool pool(thread::hardware_concurrency());
+
+    struct stat st;
+    bool headers = inputs.size() > 1 || inputs[0] == "-" || isArchive(inputs[0])
+                   || (stat(inputs[0].c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+
+    vector<unique_ptr<Sink> > sinks;
+    for(size_t i=0; i<outputs.size(); ++i) {
+        Sink::Format format;
+        string path;
+        if(!Sink::parse(outputs[i], format, path)) {
+            cerr << "Unknown output format in " << outputs[i] << ", use text, json, csv, columns, sql, pgcopy or sqlite"
+                 << " (if compiled with TFRDUMP_WITH_SQLITE)" << endl;
+            return -1;
+        }
+        sinks.push_back(unique_ptr<Sink>(new Sink(format, path, headers, pool, compression, level)));
+        sinks.back()->measure(statistics.get());
+        sinks.back()->place(i % pool.nodes());
+        if(!sinks.back()->open()) {
+            cerr << "Cannot open output file " << path << endl;
+            return -1;
+        }
+    }
+
+    // a sink holds QUEUESIZE waiting pilots and the one it formats, the slowest bounds the pilots in flight
+    DecodedPilotPool pilots(2 * Sink::QUEUESIZE);
+    int status = 0;
+    for(size_t i=0; i<inputs.size(); ++i) {
+        unique_ptr<RecordSource> source = openSource(inputs[i]);
+        if(!source) {
+            status = 1;
+            continue;
+        }
+        string name;
+        name.reserve(DecodedPilotPool::NAMECAPACITY);
+        const BYTE* record;
+        StatsSample start, read, decoded;
+        for(;;) {
+            if(statistics)
+                start.take(perf);
+            setAllocationPhase(Stats::READ);
+            if(!source->next(name, record))
+                break;
+            if(statistics)
+                read.take(perf);
+            setAllocationPhase(Stats::DECODE);
+            shared_ptr<const DecodedPilot> p = pilots.decode(name, record, source->format());
+            setAllocationPhase(Stats::PHASECOUNT);
+            if(statistics) {
+                decoded.take(perf);
+                statistics->add(Stats::READ, start, read);
+                statistics->add(Stats::DECODE, read, decoded);
+                statistics->file(name, start, read, decoded);
+            }
+            for(size_t s=0; s<sinks.size(); ++s)
+                sinks[s]->push(p);
+        }
+        setAllocationPhase(Stats::PHASECOUNT);
+        if(source->failed())
+            status = 1;
+    }
+    for(size_t s=0; s<sinks.size(); ++s) {
+        if(!sinks[s]->close()) {
+            cerr << "Error writing output" << endl;
+            status = 1;
+        }
+    }
+    if(statistics)
+        statistics->print(cerr, pool);
+#ifdef TFRDUMP_ALLOC_PROFILE
+    uint64_t hot = allocationCount[Stats::READ] + allocationCount[Stats::DECODE];
+    if(statistics && hot) {
+        cerr << "Reading and decoding allocated " << hot << " times, they should not allocate per pilot" << endl;
+        status = 1;
+    }
+#endif
+    return status;
+}
+#endif